@@ -18,6 +18,7 @@
 #include <esp.h>
 #include <esp_accelerator.h>
 #include <nn_token.h>
+#include <sw_gemm.h>
 
 // ESP API for getting contig_alloc handle
 extern contig_handle_t *lookup_handle(void *buf, enum contig_alloc_policy *policy);
@@ -49,6 +50,36 @@ void gemm_sm_probe(physical_accel_t *accel) {
     accel->esp_access_desc = (struct esp_access *) gemm_desc;
 }
 
+// Longest run of descriptors moved through the queues by one invoke iteration
+#define GEMM_INVOKE_RUN_MAX 4
+
+// Read the run of pending descriptors at the tail of q that go to the same output queue,
+// with their output entries; q must not be empty
+static unsigned gemm_invoke_peek_run(unsigned *mem, sm_queue_t *q, uint64_t *run, uint64_t *run_output) {
+    unsigned run_len = sm_queue_peek_n(q, run, GEMM_INVOKE_RUN_MAX);
+    gemm_queue_entry_t *first = (gemm_queue_entry_t *) &mem[run[0]];
+    for (unsigned i = 0; i < run_len; i++) {
+        gemm_queue_entry_t *e = (gemm_queue_entry_t *) &mem[run[i]];
+        if (e->common.output_queue != first->common.output_queue) return i;
+        run_output[i] = e->common.output_entry;
+    }
+    return run_len;
+}
+
+// Point an invoke thread at the current binding of an hpthread: cache its memory and queue, and
+// set up the memory fields of the access descriptor; returns the binding sequence number
+static unsigned gemm_invoke_bind(hpthread_args_t *h_args, struct gemm_stratus_access *desc, unsigned **mem, sm_queue_t **q) {
+    unsigned bind = hpthread_args_bind(h_args);
+    *mem = (unsigned *) h_args->mem;
+    *q = (sm_queue_t *) &((*mem)[h_args->queue_ptr]);
+    enum contig_alloc_policy policy;
+    contig_handle_t *handle = lookup_handle((void*) *mem, &policy);
+    desc->esp.contig = contig_to_khandle(*handle);
+    desc->esp.ddr_node = contig_to_most_allocated(*handle);
+    desc->esp.alloc_policy = policy;
+    return bind;
+}
+
 void *gemm_invoke(void *a) {
 #ifdef DO_PER_INVOKE
     cpu_invoke_args_t *args = (cpu_invoke_args_t *) a;
@@ -58,12 +89,16 @@ void *gemm_invoke(void *a) {
     uint64_t *context_runtime = &args->active_cycles; // for VAM
     hpthread_t *th = accel->th[context];
     hpthread_args_t *h_args = th->args;
-    unsigned *mem = (unsigned *) h_args->mem;
-    sm_queue_t *q = (sm_queue_t *) &mem[h_args->queue_ptr];
+    // Set up the local descriptor ahead of time; its ESP memory buffer follows the binding
+    struct gemm_stratus_access *gemm_access_desc;
+    gemm_access_desc = (struct gemm_stratus_access *) malloc (sizeof(struct gemm_stratus_access));
+    unsigned *mem;
+    sm_queue_t *q;
+    unsigned bind = gemm_invoke_bind(h_args, gemm_access_desc, &mem, &q);
     LOW_DEBUG(printf("[INVOKE] Started thread for invoking GeMM on %s:%d!\n", accel->devname, context);)
     // Set queue to busy
-    if (__atomic_load_n(&(q->stat), __ATOMIC_SEQ_CST) == QUEUE_BUSY) { SCHED_YIELD; };
-    __atomic_store_n(&(q->stat), QUEUE_BUSY, __ATOMIC_SEQ_CST);
+    if (sm_queue_get_stat(q) == QUEUE_BUSY) { SCHED_YIELD; };
+    sm_queue_set_stat(q, QUEUE_BUSY);
     HIGH_DEBUG(printf("[INVOKE] Queue set to busy on %s:%d!\n", accel->devname, context);)
 
     #ifndef DO_SCHED_RR
@@ -74,15 +109,6 @@ void *gemm_invoke(void *a) {
     HIGH_DEBUG(printf("[INVOKE] Set niceness to %d for %s:%d!\n", nice_table[prio - 1], accel->devname, context);)
     #endif
 
-    // Set up local descriptors for each context ahead of time
-    struct gemm_stratus_access *gemm_access_desc;
-    gemm_access_desc = (struct gemm_stratus_access *) malloc (sizeof(struct gemm_stratus_access));
-	// Setting up ESP memory buffer
-    enum contig_alloc_policy policy;
-    contig_handle_t *handle = lookup_handle((void*) mem, &policy);
-    gemm_access_desc->esp.contig = contig_to_khandle(*handle);
-    gemm_access_desc->esp.ddr_node = contig_to_most_allocated(*handle);
-    gemm_access_desc->esp.alloc_policy = policy;
     gemm_access_desc->esp.run = true;
     gemm_access_desc->esp.src_offset = 0;
     gemm_access_desc->esp.dst_offset = 0;
@@ -91,53 +117,71 @@ void *gemm_invoke(void *a) {
     gemm_access_desc->esp.p2p_store = 0;
     gemm_access_desc->esp.p2p_nsrcs = 0;
     gemm_access_desc->esp.ioctl_cm = ESP_IOCTL_ACC_NO_SM;
+    hpthread_args_ack(h_args, bind);
 
     HIGH_DEBUG(unsigned invoke_count = 0;)
 
     while (1) {
         if (*kill_pthread) { 
-            __atomic_store_n(&(q->stat), QUEUE_AVAIL, __ATOMIC_SEQ_CST);
+            sm_queue_set_stat(q, QUEUE_AVAIL);
             pthread_exit(NULL);
         }
+        // Switch to the new queue if the hpthread was rebound; no task is in flight here
+        if (hpthread_args_rebound(h_args, bind)) {
+            sm_queue_set_stat(q, QUEUE_AVAIL);
+            bind = gemm_invoke_bind(h_args, gemm_access_desc, &mem, &q);
+            sm_queue_set_stat(q, QUEUE_BUSY);
+            hpthread_args_ack(h_args, bind);
+            HIGH_DEBUG(printf("[INVOKE] Rebound %s:%d to queue %d\n", accel->devname, context, h_args->queue_ptr);)
+        }
         // Is task queue empty?
         if (!sm_queue_empty(q)) {
-            // Read descriptor from tail
-            unsigned descr_offset = sm_queue_can_pop(q);
-            gemm_queue_entry_t *e = (gemm_queue_entry_t *) &mem[descr_offset];
-            gemm_params_t *params = &(e->gemm_params);
-            gemm_access_desc->dim_m = params->dim_m;
-            gemm_access_desc->dim_n = params->dim_n;
-            gemm_access_desc->dim_k = params->dim_k;
-            gemm_access_desc->weight_base = params->weight_base;
-            gemm_access_desc->input_base = params->input_base;
-            gemm_access_desc->output_base = params->output_base;
-
-            // Wait for output queue to be not full
-            sm_queue_t *output_queue = (sm_queue_t *) &(mem[e->common.output_queue]);
-            uint64_t output_entry = e->common.output_entry;
-            sm_queue_pop(q);
-            while(sm_queue_full(output_queue)) { SCHED_YIELD; }
-            // Acquire ioctl lock
-            unsigned expected_value = 0;
-            while(!__atomic_compare_exchange_n(&accel->accel_lock, &expected_value, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) { 
-                expected_value = 0;
-                SCHED_YIELD;
-            }
-            HIGH_DEBUG(printf("[INVOKE] Starting GEMM %d on %s:%d\n", invoke_count, accel->devname, context);)
+            // Take the run of ready descriptors that share an output queue
+            uint64_t run[GEMM_INVOKE_RUN_MAX], run_output[GEMM_INVOKE_RUN_MAX];
+            unsigned run_len = gemm_invoke_peek_run(mem, q, run, run_output);
+            sm_queue_t *output_queue = (sm_queue_t *) &(mem[((gemm_queue_entry_t *) &mem[run[0]])->common.output_queue]);
+            if (run_len > sm_queue_capacity(output_queue)) run_len = sm_queue_capacity(output_queue);
+            // Wait for output queue to have space for the run
+            SM_QUEUE_WAIT_UNTIL(output_queue, SM_QUEUE_POPPED, sm_queue_room(output_queue, run_len) == run_len);
+            for (unsigned i = 0; i < run_len; i++) {
+                gemm_params_t *params = &(((gemm_queue_entry_t *) &mem[run[i]])->gemm_params);
+                if (params->prec != GEMM_PREC_Q32) {
+                    // The accelerator reads only 16.16 weights; quantized layers run on the CPU kernels
+                    gemm_params_run((nn_token_t *) mem, params);
+                    continue;
+                }
+                gemm_access_desc->dim_m = params->dim_m;
+                gemm_access_desc->dim_n = params->dim_n;
+                gemm_access_desc->dim_k = params->dim_k;
+                gemm_access_desc->weight_base = params->weight_base;
+                gemm_access_desc->input_base = params->input_base;
+                gemm_access_desc->output_base = params->output_base;
+                // Acquire ioctl lock
+                unsigned expected_value = 0;
+                while(!__atomic_compare_exchange_n(&accel->accel_lock, &expected_value, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) { 
+                    expected_value = 0;
+                    SCHED_YIELD;
+                }
+                HIGH_DEBUG(printf("[INVOKE] Starting GEMM %d on %s:%d\n", invoke_count, accel->devname, context);)
 
-            struct esp_access *esp_access_desc = (struct esp_access *) gemm_access_desc;
-            if (ioctl(accel->fd, GEMM_STRATUS_IOC_ACCESS, esp_access_desc)) {
-                perror("ioctl");
-                exit(EXIT_FAILURE);
+                struct esp_access *esp_access_desc = (struct esp_access *) gemm_access_desc;
+                if (ioctl(accel->fd, GEMM_STRATUS_IOC_ACCESS, esp_access_desc)) {
+                    perror("ioctl");
+                    exit(EXIT_FAILURE);
+                }
+                __atomic_store_n(&accel->accel_lock, 0, __ATOMIC_RELEASE);
+                // The accelerator has no epilogue; apply bias/activation before releasing the output
+                gemm_params_epilogue((nn_token_t *) mem, params);
+                uint64_t *mon_extended = (uint64_t *) esp_access_desc->mon_info.util;
+                *context_runtime += mon_extended[0]; // Single context only
+                HIGH_DEBUG(printf("[INVOKE] Finished GEMM %d on %s:%d\n", invoke_count++, accel->devname, context);)
             }
-            // Push to output queue
-            sm_queue_push(output_queue, output_entry);
-            uint64_t *mon_extended = (uint64_t *) esp_access_desc->mon_info.util;
-            *context_runtime += mon_extended[0]; // Single context only
-            __atomic_store_n(&accel->accel_lock, 0, __ATOMIC_RELEASE);
-            HIGH_DEBUG(printf("[INVOKE] Finished GEMM %d on %s:%d\n", invoke_count++, accel->devname, context);)
+            // Release the input entries only after the outputs are written, then push the whole run
+            sm_queue_pop_n(q, NULL, run_len);
+            sm_queue_push_n(output_queue, run_output, run_len);
         }
-        SCHED_YIELD;
+        // Idle: wait for the next task (or to be killed or rebound)
+        SM_QUEUE_WAIT_UNTIL(q, SM_QUEUE_PUSHED, !sm_queue_empty(q) || __atomic_load_n(kill_pthread, __ATOMIC_ACQUIRE) || hpthread_args_rebound(h_args, bind));
     }
 #else
     // Read the arguments struct
@@ -154,6 +198,10 @@ void *gemm_invoke(void *a) {
     const uint64_t SCHED_PERIOD = 7812500; // 100ms
     unsigned current_context = 0;
     hpthread_t **th = accel->th;
+    // Binding of each context, cached when it is added (or rebound)
+    unsigned *context_mem[MAX_CONTEXTS];
+    sm_queue_t *context_q[MAX_CONTEXTS];
+    unsigned context_bind[MAX_CONTEXTS];
     HIGH_DEBUG(unsigned invoke_count[MAX_CONTEXTS] = {0};)
     // Set up local descriptors for each context ahead of time
     struct gemm_stratus_access **gemm_access_desc;
@@ -178,10 +226,7 @@ void *gemm_invoke(void *a) {
         // Check for old contexts to remove
         for (int i = 0; i < MAX_CONTEXTS; i++) {
             if (!bitset_test(accel->valid_contexts, i) && bitset_test(*valid_contexts_ack, i)) {
-                hpthread_args_t *h_args = th[i]->args;
-                unsigned *mem = (unsigned *) h_args->mem;
-                sm_queue_t *q = (sm_queue_t *) &mem[h_args->queue_ptr];
-                __atomic_store_n(&(q->stat), QUEUE_AVAIL, __ATOMIC_SEQ_CST);
+                sm_queue_set_stat(context_q[i], QUEUE_AVAIL);
                 bitset_reset(*valid_contexts_ack, i);
                 HIGH_DEBUG(printf("[INVOKE] Released context %d on %s for hpthread %s\n", i, accel->devname, hpthread_get_name(th[i]));)
             }
@@ -216,22 +261,26 @@ void *gemm_invoke(void *a) {
             if (bitset_count(accel->valid_contexts) > 1)
                 printf("[INVOKE] Selected context %d on %s\n", current_context, accel->devname);
         )
-        // Check for new contexts to add
+        // Check for new contexts to add, and for rebound ones
         for (int i = 0; i < MAX_CONTEXTS; i++) {
+            if (bitset_test(accel->valid_contexts, i) && bitset_test(*valid_contexts_ack, i) && hpthread_args_rebound(th[i]->args, context_bind[i])) {
+                // Only this thread runs the context's tasks, so none is in flight here
+                sm_queue_set_stat(context_q[i], QUEUE_AVAIL);
+                context_bind[i] = gemm_invoke_bind(th[i]->args, gemm_access_desc[i], &context_mem[i], &context_q[i]);
+                sm_queue_set_stat(context_q[i], QUEUE_BUSY);
+                hpthread_args_ack(th[i]->args, context_bind[i]);
+                HIGH_DEBUG(printf("[INVOKE] Rebound context %d on %s for hpthread %s\n", i, accel->devname, hpthread_get_name(th[i]));)
+            }
             if (bitset_test(accel->valid_contexts, i) && !bitset_test(*valid_contexts_ack, i)) {
                 hpthread_args_t *h_args = th[i]->args;
-                unsigned *mem = (unsigned *) h_args->mem;
-                sm_queue_t *q = (sm_queue_t *) &mem[h_args->queue_ptr];
-                if (__atomic_load_n(&(q->stat), __ATOMIC_SEQ_CST) == QUEUE_BUSY) { SCHED_YIELD; continue; };
-                __atomic_store_n(&(q->stat), QUEUE_BUSY, __ATOMIC_SEQ_CST);
+                sm_queue_t *q = (sm_queue_t *) &(((unsigned *) h_args->mem)[h_args->queue_ptr]);
+                if (sm_queue_get_stat(q) == QUEUE_BUSY) { SCHED_YIELD; continue; };
+                // We will populate the common fields of esp_access
+                context_bind[i] = gemm_invoke_bind(h_args, gemm_access_desc[i], &context_mem[i], &context_q[i]);
+                sm_queue_set_stat(context_q[i], QUEUE_BUSY);
+                hpthread_args_ack(h_args, context_bind[i]);
                 bitset_set(*valid_contexts_ack, i);
                 context_vruntime[i] = min_vruntime + 1; // Initialize vruntime
-                // We will populate the common fields of esp_access
-                enum contig_alloc_policy policy;
-                contig_handle_t *handle = lookup_handle((void*) mem, &policy);
-                gemm_access_desc[i]->esp.contig = contig_to_khandle(*handle);
-                gemm_access_desc[i]->esp.ddr_node = contig_to_most_allocated(*handle);
-                gemm_access_desc[i]->esp.alloc_policy = policy;
                 gemm_access_desc[i]->esp.run = true;
                 gemm_access_desc[i]->esp.src_offset = 0;
                 gemm_access_desc[i]->esp.dst_offset = 0;
@@ -248,44 +297,57 @@ void *gemm_invoke(void *a) {
             sched_period_elapsed = get_counter();
             HIGH_DEBUG(printf("[INVOKE] Scheduling period elapsed for %s\n", accel->devname);)
         }
+        // The selected context may still be waiting to be added
+        if (!bitset_test(*valid_contexts_ack, current_context)) {
+            SCHED_YIELD;
+            continue;
+        }
         // Read arguments for next context
-        hpthread_args_t *h_args = th[current_context]->args;
-        unsigned *mem = (unsigned *) h_args->mem;
-        sm_queue_t *q = (sm_queue_t *) &mem[h_args->queue_ptr];
+        unsigned *mem = context_mem[current_context];
+        sm_queue_t *q = context_q[current_context];
         unsigned nprio = th[current_context]->nprio;
         clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_time);
 
         // Is task queue empty?
         if (!sm_queue_empty(q)) {
             vruntime_scale[current_context] = 1; // Reset penalty
-            // Read descriptor from tail
-            unsigned descr_offset = sm_queue_can_pop(q);
-            gemm_queue_entry_t *e = (gemm_queue_entry_t *) &mem[descr_offset];
-            gemm_params_t *params = &(e->gemm_params);
-            gemm_access_desc[current_context]->dim_m = params->dim_m;
-            gemm_access_desc[current_context]->dim_n = params->dim_n;
-            gemm_access_desc[current_context]->dim_k = params->dim_k;
-            gemm_access_desc[current_context]->weight_base = params->weight_base;
-            gemm_access_desc[current_context]->input_base = params->input_base;
-            gemm_access_desc[current_context]->output_base = params->output_base;
+            // Take the run of ready descriptors that share an output queue
+            uint64_t run[GEMM_INVOKE_RUN_MAX], run_output[GEMM_INVOKE_RUN_MAX];
+            unsigned run_len = gemm_invoke_peek_run(mem, q, run, run_output);
+            sm_queue_t *output_queue = (sm_queue_t *) &(mem[((gemm_queue_entry_t *) &mem[run[0]])->common.output_queue]);
 
-            // Wait for output queue to be not full
-            sm_queue_t *output_queue = (sm_queue_t *) &(mem[e->common.output_queue]);
-            uint64_t output_entry = e->common.output_entry;
-            while(sm_queue_full(output_queue)) { SCHED_YIELD; continue; }
-            sm_queue_pop(q);
-            HIGH_DEBUG(printf("[INVOKE] Starting GEMM %d for context %d on %s\n", invoke_count[current_context], current_context, accel->devname);)
-
-            struct esp_access *esp_access_desc = (struct esp_access *) gemm_access_desc[current_context];
-            if (ioctl(accel->fd, GEMM_STRATUS_IOC_ACCESS, esp_access_desc)) {
-                perror("ioctl");
-                exit(EXIT_FAILURE);
+            // Wait for output queue to be not full; the run shrinks to the space available
+            SM_QUEUE_WAIT_UNTIL(output_queue, SM_QUEUE_POPPED, !sm_queue_full(output_queue));
+            unsigned output_space = sm_queue_room(output_queue, run_len);
+            if (run_len > output_space) run_len = output_space;
+            for (unsigned i = 0; i < run_len; i++) {
+                gemm_params_t *params = &(((gemm_queue_entry_t *) &mem[run[i]])->gemm_params);
+                HIGH_DEBUG(printf("[INVOKE] Starting GEMM %d for context %d on %s\n", invoke_count[current_context], current_context, accel->devname);)
+                if (params->prec != GEMM_PREC_Q32) {
+                    // The accelerator reads only 16.16 weights; quantized layers run on the CPU kernels
+                    gemm_params_run((nn_token_t *) mem, params);
+                } else {
+                    gemm_access_desc[current_context]->dim_m = params->dim_m;
+                    gemm_access_desc[current_context]->dim_n = params->dim_n;
+                    gemm_access_desc[current_context]->dim_k = params->dim_k;
+                    gemm_access_desc[current_context]->weight_base = params->weight_base;
+                    gemm_access_desc[current_context]->input_base = params->input_base;
+                    gemm_access_desc[current_context]->output_base = params->output_base;
+                    struct esp_access *esp_access_desc = (struct esp_access *) gemm_access_desc[current_context];
+                    if (ioctl(accel->fd, GEMM_STRATUS_IOC_ACCESS, esp_access_desc)) {
+                        perror("ioctl");
+                        exit(EXIT_FAILURE);
+                    }
+                    // The accelerator has no epilogue; apply bias/activation before releasing the output
+                    gemm_params_epilogue((nn_token_t *) mem, params);
+                    uint64_t *mon_extended = (uint64_t *) esp_access_desc->mon_info.util;
+                    context_runtime[current_context] += mon_extended[0]; // Single context only
+                }
+                HIGH_DEBUG(printf("[INVOKE] Finished GEMM %d for context %d on %s\n", invoke_count[current_context]++, current_context, accel->devname);)
             }
-            // Push to output queue
-            sm_queue_push(output_queue, output_entry);
-            uint64_t *mon_extended = (uint64_t *) esp_access_desc->mon_info.util;
-            context_runtime[current_context] += mon_extended[0]; // Single context only
-            HIGH_DEBUG(printf("[INVOKE] Finished GEMM %d for context %d on %s\n", invoke_count[current_context]++, current_context, accel->devname);)
+            // Release the input entries only after the outputs are written, then push the whole run
+            sm_queue_pop_n(q, NULL, run_len);
+            sm_queue_push_n(output_queue, run_output, run_len);
         } else {
             vruntime_scale[current_context] += 1; // Penalize for idling
         }
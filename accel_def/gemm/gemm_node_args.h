@@ -8,6 +8,8 @@ typedef struct {
     gemm_params_t params;
     // Input file for read-only parameters
     char input_file[100];
+    // Optional bias vector ("bias=<file>" in the model); empty if the layer has no bias
+    char bias_file[100];
 } gemm_node_args;
 
 #endif // __GEMM_NODE_ARGS_H__
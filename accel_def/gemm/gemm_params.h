@@ -1,7 +1,24 @@
 #ifndef __GEMM_PARAMS_H__
 #define __GEMM_PARAMS_H__
 
-#define GEMM_PARAM_SIZE 6
+#define GEMM_PARAM_SIZE 16
+
+// Host-only flags for GEMM tasks
+#define GEMM_FLAG_PACKED 0x1 // packed_base holds the weights pre-packed for the CPU kernels
+#define GEMM_FLAG_BIAS 0x2 // bias_base holds dim_n values added to every output row
+
+// Activations fused into the GEMM output, applied after the bias. Only CPU kernels and CPU
+// invoke threads apply them; nn_module_load rejects them on queues an accelerator polls.
+#define GEMM_ACT_NONE 0
+#define GEMM_ACT_RELU 1 // max(x, 0)
+#define GEMM_ACT_CLAMP 2 // min(max(x, act_lo), act_hi)
+#define GEMM_ACT_SAT 3 // Accumulate in 64 bits and saturate to the 16.16 range instead of wrapping
+
+// Storage precision of the weights; inputs and outputs are always 16.16 tokens. The quantized
+// formats are rejected by nn_module_load on queues an accelerator polls.
+#define GEMM_PREC_Q32 0 // nn_token_t, read by the accelerator
+#define GEMM_PREC_Q16 1 // nn_token_q16_t with per-layer scale and zero point (CPU only)
+#define GEMM_PREC_Q8 2 // nn_token_q8_t with per-layer scale and zero point (CPU only)
 
 // Task parameters for GEMM
 typedef struct {
@@ -12,6 +29,21 @@ typedef struct {
     unsigned weight_base;
     unsigned input_base;
     unsigned output_base;
+    // Host-only extensions; the accelerator reads only the fields above
+    unsigned flags; // GEMM_FLAG_*
+    unsigned packed_base; // Offset of the weight panels built by gemm_pack_b
+    unsigned bias_base; // Offset of the bias vector
+    unsigned act; // GEMM_ACT_*
+    int act_lo, act_hi; // Raw 16.16 bounds for GEMM_ACT_CLAMP
+    unsigned prec; // GEMM_PREC_*
+    int q_scale; // Raw 16.16 step of one quantized unit
+    int q_zero; // Quantized value that represents 0.0
+    unsigned tune; // Tuning table slot resolved at load (gemm_tune_slot), 0 for the built-in choice
 } gemm_params_t;
 
+// Does the task need a bias or activation pass over its output?
+static inline int gemm_params_has_epilogue(const gemm_params_t *p) {
+    return (p->flags & GEMM_FLAG_BIAS) || p->act == GEMM_ACT_RELU || p->act == GEMM_ACT_CLAMP;
+}
+
 #endif // __GEMM_PARAMS_H__
@@ -20,6 +20,11 @@ static inline void print_gemm_entry(gemm_queue_entry_t *e) {
     printf("\tweight_base=%d\n", e->gemm_params.weight_base);
     printf("\tinput_base=%d\n", e->gemm_params.input_base);
     printf("\toutput_base=%d\n", e->gemm_params.output_base);
+    printf("\tflags=0x%x\n", e->gemm_params.flags);
+    printf("\tpacked_base=%d\n", e->gemm_params.packed_base);
+    printf("\tbias_base=%d\n", e->gemm_params.bias_base);
+    printf("\tact=%d [%d, %d]\n", e->gemm_params.act, e->gemm_params.act_lo, e->gemm_params.act_hi);
+    printf("\tprec=%d scale=%d zero=%d\n", e->gemm_params.prec, e->gemm_params.q_scale, e->gemm_params.q_zero);
 }
     
 #endif // __GEMM_QUEUE_H__
@@ -22,12 +22,21 @@ int validate_buffer(nn_token_t *mem_c, nn_token_t *gold_c)
     unsigned errors = 0;
     const unsigned len = dim_m * dim_n;
 
+    // Convert the differences and the reference in bulk, then compare
+    nn_token_t *diff = (nn_token_t *) malloc(len * sizeof(nn_token_t));
+    float *diff_f = (float *) malloc(len * sizeof(float));
+    float *gold_f = (float *) malloc(len * sizeof(float));
+    for (unsigned j = 0; j < len; j++) diff[j] = nn_token_sub(gold_c[j], mem_c[j]);
+    nn_tokens_to_floats(diff_f, diff, len);
+    nn_tokens_to_floats(gold_f, gold_c, len);
+
     for (unsigned j = 0; j < len; j++) {
-        if ((fabs(nn_token_to_float(nn_token_sub(gold_c[j], mem_c[j]))) / fabs(nn_token_to_float(gold_c[j]))) > ERR_TH) {
+        if ((fabs(diff_f[j]) / fabs(gold_f[j])) > ERR_TH) {
             if (errors < 2) { HIGH_DEBUG(printf("\tGOLD[%u] = %f vs %f = out[%u]\n", j, nn_token_to_float(gold_c[j]), nn_token_to_float(mem_c[j]), j);) }
             errors++;
         }
     }
+    free(diff); free(diff_f); free(gold_f);
 
     HIGH_DEBUG(printf("\tRelative error > %.02f for %d values out of %d\n", ERR_TH, errors, len);)
 
@@ -44,21 +53,26 @@ void init_buffer(nn_token_t *mem_a, nn_token_t *mem_b, nn_token_t *gold_a, nn_to
 
     srand((unsigned int) time(NULL));
 
+    // Draw the inputs as floats, then convert them in bulk
+    float *in_f = (float *) malloc((len_a > len_b ? len_a : len_b) * sizeof(float));
     for (unsigned j = 0; j < len_a; j++) {
         float scaling_factor = (float) rand() / (float) RAND_MAX;
-        gold_a[j] = nn_token_from_float(LO + scaling_factor * (HI - LO));
-        mem_a[j] = nn_token_from_float(LO + scaling_factor * (HI - LO));
+        in_f[j] = LO + scaling_factor * (HI - LO);
     }
+    nn_tokens_from_floats(gold_a, in_f, len_a);
+    nn_tokens_from_floats(mem_a, in_f, len_a);
 
     for (unsigned j = 0; j < len_b; j++) {
         float scaling_factor = (float) rand() / (float) RAND_MAX;
-        gold_b[j] = nn_token_from_float(LO + scaling_factor * (HI - LO));
-        mem_b[j] = nn_token_from_float(LO + scaling_factor * (HI - LO));
+        in_f[j] = LO + scaling_factor * (HI - LO);
     }
+    nn_tokens_from_floats(gold_b, in_f, len_b);
+    nn_tokens_from_floats(mem_b, in_f, len_b);
+    free(in_f);
 
     // Compute golden output
     uint64_t t_start = get_counter();
-    gemm(gold_a, gold_b, gold_c, dim_m, dim_n, dim_k);
+    gemm_parallel(gold_a, gold_b, gold_c, dim_m, dim_n, dim_k, NULL);
     t_sw += get_counter() - t_start;
 }
 
@@ -181,6 +195,7 @@ int main(int argc, char **argv) {
     errors += validate_buffer(&mem[mat_c_offset], &gold[mat_c_offset]);
 
     hpthread_join(th);
+    gemm_pool_release();
 
     free(gold);
     esp_free(mem);
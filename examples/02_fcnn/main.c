@@ -68,13 +68,20 @@ int main(int argc, char **argv) {
         nn_token_t *gold_data = (nn_token_t *) malloc (output_len * sizeof(nn_token_t));
         initialize_data("output.txt", gold_data, output_len);
 
-        // Compare with actual output
+        // Compare with actual output; the differences and the reference are converted in bulk
+        nn_token_t *diff_data = (nn_token_t *) malloc (output_len * sizeof(nn_token_t));
+        float *diff_f = (float *) malloc (output_len * sizeof(float));
+        float *gold_f = (float *) malloc (output_len * sizeof(float));
+        for (unsigned j = 0; j < output_len; j++) diff_data[j] = nn_token_sub(gold_data[j], output_data[j]);
+        nn_tokens_to_floats(diff_f, diff_data, output_len);
+        nn_tokens_to_floats(gold_f, gold_data, output_len);
         for (unsigned j = 0; j < output_len; j++) {
-            if ((fabs(nn_token_to_float(nn_token_sub(gold_data[j], output_data[j]))) / fabs(nn_token_to_float(gold_data[j]))) > ERR_TH) {
+            if ((fabs(diff_f[j]) / fabs(gold_f[j])) > ERR_TH) {
                 if (errors < 2) { HIGH_DEBUG(printf("\tGOLD[%u] = %f vs %f = out[%u]\n", j, nn_token_to_float(gold_data[j]), nn_token_to_float(output_data[j]), j);) }
                 errors++;
             }
         }
+        free(diff_data); free(diff_f); free(gold_f);
         printf("[APP] Relative error > %.02f for %d values out of %d\n", ERR_TH, errors, output_len);
 
         #ifdef ENABLE_VAM
@@ -152,6 +152,9 @@ int main(int argc, char **argv) {
     pthread_join(rsp_th, NULL);
     #endif // DO_CHAIN
     #endif // ENABLE_VAM
+    #ifdef DO_QUEUE_STATS
+    nn_module_print_queue_stats(m);
+    #endif
     nn_module_release(m);
     free(m);
 #ifdef ENABLE_VAM
@@ -211,7 +211,8 @@ int main(int argc, char **argv) {
         #else
         cmd_module->cpu_invoke = false;
         #endif
-        nn_module_load_and_register(cmd_module, model_list[i+th_offset]);
+        // Registered below, once the pool is warm
+        nn_module_load(cmd_module, model_list[i+th_offset]);
         args->cmd_module = cmd_module;
         
         // Start a request thread for this model
@@ -258,6 +259,26 @@ int main(int argc, char **argv) {
     while (tail->next != NULL) tail = tail->next;
     tail->next = head;
 
+    #if defined(ENABLE_VAM) && defined(DO_WARM_POOL)
+    // Park as many hpthreads as the models ask for, so that registering a model only rebinds them
+    unsigned pool_size = 0;
+    thread_args *cur = head;
+    for (unsigned i = 0; i < n_threads; i++) {
+        pool_size += nn_module_hpthread_count(cur->cmd_module);
+        cur = cur->next;
+    }
+    hpthread_pool_fill(PRIM_GEMM, head->cmd_module->cpu_invoke, head->cmd_module->nprio, pool_size);
+    #endif
+
+    // Register all models; this and the release below are the tenant churn the pool hides
+    uint64_t churn_start = get_counter();
+    thread_args *reg = head;
+    for (unsigned i = 0; i < n_threads; i++) {
+        nn_module_register(reg->cmd_module);
+        reg = reg->next;
+    }
+    printf("[MAIN] Registered %d models in %0.2f us\n", n_threads, (float) (get_counter() - churn_start) / 78.125);
+
     // Wait for all threads to wake up
     srand(time(NULL));
     sleep(1);
@@ -339,6 +360,7 @@ int main(int argc, char **argv) {
     }
 
     // Release all modules
+    churn_start = get_counter();
     args = head;
     do {
         nn_module *cmd_module = args->cmd_module;
@@ -348,7 +370,11 @@ int main(int argc, char **argv) {
         free(args);
         args = next;     
     } while (args != head);
+    printf("[MAIN] Released %d models in %0.2f us\n", n_threads, (float) (get_counter() - churn_start) / 78.125);
 #ifdef ENABLE_VAM
+#ifdef DO_WARM_POOL
+    hpthread_pool_drain();
+#endif
     hpthread_report();
 #endif
 }
@@ -0,0 +1,11 @@
+#ifndef __HELPER_H__
+#define __HELPER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <common_helper.h>
+#include <nn_token.h>
+
+#endif // __HELPER_H__
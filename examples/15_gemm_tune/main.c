@@ -0,0 +1,81 @@
+#include <helper.h>
+#include <nn_graph.h>
+#include <sw_gemm.h>
+
+////////////////////////////////////
+// Tuning mode for the software GEMM: collects every GEMM shape
+// used by the models in a directory, sweeps the tiling, loop order
+// and thread count of each and writes the winners to a tuning file
+// that the GEMM dispatch loads at startup.
+
+#define MAX_SHAPES GEMM_TUNE_MAX
+
+unsigned shapes[MAX_SHAPES][3];
+unsigned n_shapes = 0;
+unsigned reps = 20;
+
+// Add the GEMM node shapes of one model file
+void collect_shapes(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("fopen");
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned id, op, m, n, k;
+        if (sscanf(line, "N %u %u %u %u %u", &id, &op, &m, &n, &k) != 5 || op != NN_OP_GEMM) continue;
+        bool found = false;
+        for (unsigned i = 0; i < n_shapes; i++) {
+            if (shapes[i][0] == m && shapes[i][1] == n && shapes[i][2] == k) found = true;
+        }
+        if (!found && n_shapes < MAX_SHAPES) {
+            shapes[n_shapes][0] = m; shapes[n_shapes][1] = n; shapes[n_shapes][2] = k;
+            n_shapes++;
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s <model dir> [tuning file] [reps]\n", argv[0]);
+        return 1;
+    }
+    const char *model_dir = argv[1];
+    const char *tune_file = (argc > 2) ? argv[2] : GEMM_TUNE_FILE;
+    if (argc > 3) reps = atoi(argv[3]);
+
+    DIR *dir = opendir(model_dir);
+    if (!dir) {
+        perror("opendir");
+        return 1;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", model_dir, ent->d_name);
+        collect_shapes(path);
+    }
+    closedir(dir);
+    printf("[APP] Tuning %d GEMM shapes from %s\n", n_shapes, model_dir);
+
+    // Keep the entries of other shapes already in the file; the pool may use every CPU
+    gemm_tune_load(tune_file);
+    gemm_pool_setthreads(0);
+    for (unsigned i = 0; i < n_shapes; i++) {
+        gemm_tune_t best;
+        gemm_tune_shape(shapes[i][0], shapes[i][1], shapes[i][2], reps, &best);
+        printf("[APP] %dx%dx%d: tile %dx%d order %d threads %d\n", best.dim_m, best.dim_n, best.dim_k,
+            best.tile_m, best.tile_n, best.order, best.threads);
+    }
+    gemm_pool_release();
+
+    if (gemm_tune_save(tune_file) < 0) {
+        perror("gemm_tune_save");
+        return 1;
+    }
+    printf("[APP] Wrote %s\n", tune_file);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <helper.h>
+
+////////////////////////////////////
+// Converts a text weight file (whitespace separated floats, as read
+// by initialize_data) into the binary format loaded with mmap. The
+// model description can keep the same node line and point at the
+// new file; the loader detects the format from the header.
+
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 5) {
+        printf("Usage: %s <text weights> <binary weights> [rows cols]\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (!in) {
+        perror("fopen");
+        return 1;
+    }
+
+    // Read every value; the shape defaults to a single column
+    unsigned len = 0, cap = 1024;
+    float *data = (float *) malloc(cap * sizeof(float));
+    float v;
+    while (fscanf(in, "%f ", &v) == 1) {
+        if (len == cap) {
+            cap *= 2;
+            data = (float *) realloc(data, cap * sizeof(float));
+        }
+        data[len++] = v;
+    }
+    if (!feof(in)) {
+        printf("[APP] Unexpected data in %s after %d values\n", argv[1], len);
+        return 1;
+    }
+    fclose(in);
+
+    unsigned rows = len, cols = 1;
+    if (argc == 5) {
+        rows = atoi(argv[3]);
+        cols = atoi(argv[4]);
+        if (rows * cols != len) {
+            printf("[APP] %s has %d values, expected %dx%d\n", argv[1], len, rows, cols);
+            return 1;
+        }
+    }
+
+    nn_token_t *tokens = (nn_token_t *) malloc(len * sizeof(nn_token_t));
+    nn_tokens_from_floats(tokens, data, len);
+    if (nn_weights_write(argv[2], tokens, rows, cols) != 0) {
+        perror("nn_weights_write");
+        return 1;
+    }
+    printf("[APP] Wrote %dx%d weights to %s\n", rows, cols, argv[2]);
+    free(data);
+    free(tokens);
+    return 0;
+}
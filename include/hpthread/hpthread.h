@@ -8,14 +8,32 @@ typedef struct physical_accel_t physical_accel_t;
 typedef uint8_t hpthread_prim_t;
 struct hpthread_cand_t;
 typedef struct hpthread_cand_t hpthread_cand_t;
+struct hpthread_snap_t;
+typedef struct hpthread_snap_t hpthread_snap_t;
+struct hpthread_req_t;
+typedef struct hpthread_req_t hpthread_req_t;
 
 // hpthread arguments
 typedef struct {
     void *mem; // Memory pool allocated for the hpthread
     unsigned queue_ptr; // Queue base pointer
     bool *kill_pthread; // Kill the CPU pthread
+    unsigned bind_seq; // Bumped when mem and queue_ptr are rebound (hpthread_rebind)
+    unsigned bind_ack; // Last bind_seq the worker has switched to
 } hpthread_args_t;
 
+// Worker side of hpthread_rebind(): a worker caches mem and queue_ptr, checks for a new
+// binding at a safe point (no task in flight), switches its queue and acknowledges
+static inline bool hpthread_args_rebound(hpthread_args_t *a, unsigned seq) {
+    return __atomic_load_n(&(a->bind_seq), __ATOMIC_ACQUIRE) != seq;
+}
+static inline unsigned hpthread_args_bind(hpthread_args_t *a) {
+    return __atomic_load_n(&(a->bind_seq), __ATOMIC_ACQUIRE);
+}
+static inline void hpthread_args_ack(hpthread_args_t *a, unsigned seq) {
+    __atomic_store_n(&(a->bind_ack), seq, __ATOMIC_RELEASE);
+}
+
 // Device-agnostic thread abstraction for accelerators
 typedef struct {
     unsigned id; // Integer ID
@@ -29,6 +47,7 @@ typedef struct {
     uint64_t th_last_move; // When was this thread last migrated?
     bool cpu_invoke; // Is the accelerator invoked by a CPU thread?
     unsigned affinity; // Preferred accelerator ID (id + 1); 0 = no preference
+    bool pooled; // Owned by the warm pool (hpthread_pool_get)
     // Debug variables
     char name[100]; // Name
     unsigned user_id; // ID of user app
@@ -38,12 +57,39 @@ typedef struct {
 void hpthread_init(hpthread_t *th, unsigned user_id);
 void hpthread_create(hpthread_t *th);
 int hpthread_join(hpthread_t *th);
+// Batched variants: one VAM request for n hpthreads, placed against a single utilization sample
+void hpthread_create_n(hpthread_t **th, unsigned n);
+int hpthread_join_n(hpthread_t **th, unsigned n);
+// Asynchronous create: returns a handle at once while VAM places the hpthreads. Poll it with
+// hpthread_test(); hpthread_wait() blocks until the hpthreads are active and frees the handle, and
+// must be called once per handle before the hpthreads (or the th array) are used again
+hpthread_req_t *hpthread_create_async(hpthread_t *th);
+hpthread_req_t *hpthread_create_n_async(hpthread_t **th, unsigned n);
+bool hpthread_test(hpthread_req_t *req);
+void hpthread_wait(hpthread_req_t *req);
+// Point an active hpthread at a new memory pool and input queue (args->mem, args->queue_ptr),
+// without placing it again; its current queue must be idle
+void hpthread_rebind(hpthread_t *th, hpthread_args_t *args);
+void hpthread_rebind_n(hpthread_t **th, hpthread_args_t **args, unsigned n); // one VAM request
+// Warm pool: hpthreads created ahead of time and parked on queues of their own. Taking one
+// out and putting it back only rebinds it, instead of a full create and join.
+void hpthread_pool_fill(hpthread_prim_t prim, bool cpu_invoke, unsigned nprio, unsigned n);
+hpthread_t *hpthread_pool_get(hpthread_prim_t prim, bool cpu_invoke, hpthread_args_t *args); // NULL if none parked
+// Take up to n parked hpthreads, bound to args[0..] in order; returns how many were taken
+unsigned hpthread_pool_get_n(hpthread_prim_t prim, bool cpu_invoke, hpthread_args_t **args, hpthread_t **th, unsigned n);
+void hpthread_pool_put(hpthread_t *th);
+void hpthread_pool_put_n(hpthread_t **th, unsigned n);
+void hpthread_pool_drain(); // join all parked hpthreads
 void hpthread_setargs(hpthread_t *th, hpthread_args_t *a);
 void hpthread_setname(hpthread_t *th, const char *n);
 void hpthread_setprimitive(hpthread_t *th, hpthread_prim_t p);
 void hpthread_setpriority(hpthread_t *th, unsigned p);
 void hpthread_setaffinity(hpthread_t *th, unsigned accel_id);
 hpthread_cand_t *hpthread_query();
+// Copy the accelerator table last published by VAM into snap (up to max entries) and return the
+// number of accelerators. Reads never block VAM or wait for a request; version, if not NULL, is
+// set to the table version, which changes with every publication.
+unsigned hpthread_snapshot(hpthread_snap_t *snap, unsigned max, uint32_t *version);
 void hpthread_report();
 static inline hpthread_prim_t hpthread_get_prim(hpthread_t *th) { return th->prim; }
 
@@ -65,4 +111,15 @@ struct hpthread_cand_t {
     hpthread_cand_t *next;
 };
 
+// Accelerator entry of the VAM snapshot table, which holds up to HPTHREAD_SNAP_MAX of them
+#define HPTHREAD_SNAP_MAX 32
+struct hpthread_snap_t {
+    unsigned accel_id;
+    hpthread_prim_t prim;
+    bool cpu_invoke;
+    unsigned free_contexts; // Contexts not allocated to any hpthread
+    float effective_util; // Utilization in the last VAM epoch, weighted by priority
+    float queue_pressure; // Sum over allocated contexts of the input queue level (0.0 - 1.0 each)
+};
+
 #endif // __HPTHREAD_H__
@@ -3,23 +3,64 @@
 
 #include <hpthread.h>
 
-// State enumeration for hpthread request interface
+// State enumeration for the VAM thread behind the interface
 #define VAM_RESET 0
 #define VAM_WAKEUP 1
 #define VAM_IDLE 2
-#define VAM_BUSY 3
-#define VAM_DONE 4
+// Request operations
 #define VAM_CREATE 5
 #define VAM_JOIN 6
 #define VAM_SETPRIO 7
 #define VAM_REPORT 8
 #define VAM_QUERY 9
+#define VAM_REBIND 10
 
-// hpthread interface definition
+// Number of requests that can be queued for VAM (power of 2)
+#define VAM_RING_SIZE 64
+
+// A request to VAM (typedef in hpthread.h); lives with the caller until it is complete
+struct hpthread_req_t {
+    uint8_t op; // Request operation
+    hpthread_t **th; // hpthreads for the request
+    unsigned n; // number of hpthreads (CREATE and JOIN take several)
+    hpthread_t *single; // storage for th of a single asynchronous create
+    hpthread_cand_t *list; // hpthread candidate list (QUERY)
+    hpthread_args_t **args; // new binding of each hpthread (REBIND)
+    uint32_t done; // Completion flag, set by VAM; callers sleep on the interface's completed word
+};
+
+// Accelerators in the snapshot table, and its size in 32-bit words
+#define VAM_SNAP_MAX HPTHREAD_SNAP_MAX
+#define VAM_SNAP_WORDS (VAM_SNAP_MAX * sizeof(hpthread_snap_t) / sizeof(uint32_t))
+
+// Snapshot table published by VAM under a seqlock: seq is odd while VAM writes it, and the
+// entries are kept as words so that readers can copy them with atomic loads
+typedef struct {
+    uint32_t seq;
+    uint32_t n;
+    uint32_t words[VAM_SNAP_WORDS];
+} hpthread_snap_table_t;
+
+// Ring slot: for position pos in lap = pos / VAM_RING_SIZE, seq == 2 * lap when the slot is free and
+// 2 * lap + 1 when it holds a request, so the zero-initialized ring is ready to use
 typedef struct {
-    volatile uint8_t state; // Interface synchronization variable
-    hpthread_t *th; // hpthread for the request
-    hpthread_cand_t *list; // hpthread candidate list
+    uint64_t seq;
+    hpthread_req_t *req;
+} hpthread_intf_cell_t;
+
+// hpthread interface definition: a multi-producer ring drained by VAM, a doorbell futex
+// that producers ring only while VAM sleeps on it, and a completion futex that VAM bumps
+// only while callers sleep on it (a request may be freed as soon as it is done)
+typedef struct {
+    volatile uint8_t state; // VAM thread state
+    uint64_t head __attribute__((aligned(64))); // Next slot to reserve (producers)
+    uint64_t tail __attribute__((aligned(64))); // Next slot to drain (VAM)
+    uint32_t doorbell;
+    uint32_t sleeping;
+    uint32_t completed;
+    uint32_t waiters;
+    hpthread_intf_cell_t cells[VAM_RING_SIZE] __attribute__((aligned(64)));
+    hpthread_snap_table_t snap __attribute__((aligned(64)));
 } hpthread_intf_t;
 
 // Helper function for swapping the state of the interface
@@ -29,4 +70,19 @@ uint8_t hpthread_intf_test();
 // Helper function for setting the state of the interface
 void hpthread_intf_set(uint8_t set_value);
 
+// Caller side: queue a request and wake VAM, then block until VAM completes it
+void hpthread_intf_submit(hpthread_req_t *req);
+void hpthread_intf_wait(hpthread_req_t *req);
+// VAM side: take the next request (NULL if none), signal its completion, and sleep until a
+// request arrives or timeout_ns passes
+hpthread_req_t *hpthread_intf_next();
+void hpthread_intf_complete(hpthread_req_t *req);
+void hpthread_intf_sleep(uint64_t timeout_ns);
+
+// VAM side: publish a new snapshot table of n accelerators
+void hpthread_intf_publish(hpthread_snap_t *snap, unsigned n);
+// Caller side: copy the snapshot table (up to max entries) and return its number of accelerators;
+// version is 0 if VAM has not published yet
+unsigned hpthread_intf_snapshot(hpthread_snap_t *snap, unsigned max, uint32_t *version);
+
 #endif // __HPTHREAD_INTF_H__
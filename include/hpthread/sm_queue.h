@@ -1,24 +1,136 @@
 #ifndef __SM_QUEUE_H__
 #define __SM_QUEUE_H__
 
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <hpthread.h>
 
 #define SM_ENTRY_SIZE 2
 #define SM_COMMON_SIZE 6
-#define SM_QUEUE_SIZE 4
+#define SM_QUEUE_SIZE 4 // Capacity of the plain layout, which the accelerators poll
+#define SM_QUEUE_MAX 1024 // Capacity limit of the SPSC and MPMC layouts
+
+// SPSC layout for queues only the CPU touches: the producer line holds stat, head and the
+// producer's cached tail; the consumer line holds tail and the consumer's cached head; the
+// entries start on the third line. Each side re-reads the other's index only when its cached
+// copy says the queue is full (producer) or empty (consumer), so polling stays in its own line.
+// The layout flag sits in the upper half of stat and the capacity (any power of two up to
+// SM_QUEUE_MAX) in a spare header word, so the plain layout stays the one the accelerators poll.
+#define SM_QUEUE_LINE 8 // uint64_t per cache line
+#define SM_QUEUE_LINE_WORDS (SM_QUEUE_LINE * 2)
+#define SM_QUEUE_SPSC_WORDS(capacity) (2 * SM_QUEUE_LINE_WORDS + (capacity) * 2) // must start on a cache line
+#define SM_QUEUE_SPSC (1ull << 32) // layout flag in the stat word
+#define SM_QUEUE_CAPACITY 3 // header word holding the capacity, on the producer line
+
+// MPMC layout for queues several CPU threads push to or pop from: same lines as the SPSC layout,
+// but head and tail are reservation counters advanced by CAS and every entry carries a sequence
+// number that tells whose turn it is (pos: free for the producer of pos, pos + 1: ready for its
+// consumer), so a slot is handed over only once its reader or writer is done with it.
+#define SM_QUEUE_MPMC_WORDS(capacity) (2 * SM_QUEUE_LINE_WORDS + (capacity) * 4) // must start on a cache line
+#define SM_QUEUE_MPMC (1ull << 33) // layout flag in the stat word
+#define SM_QUEUE_MPMC_MIN 2 // smallest capacity: with 1, a released entry's sequence equals a ready one's
+#define SM_QUEUE_LAYOUT (SM_QUEUE_SPSC | SM_QUEUE_MPMC)
+#define SM_QUEUE_STAT_MASK ((1ull << 32) - 1) // QUEUE_* status, below the flags
+
+// Blocking waits, for the SPSC and MPMC layouts only: a waiter spins SM_QUEUE_SPIN rounds, then
+// sleeps on a futex word that the other side bumps (and wakes) only while someone sleeps on it.
+// Sleeps are cut at SM_QUEUE_WAIT_NS so waiters also notice conditions nobody signals.
+#define SM_QUEUE_BLOCK (1ull << 34) // flag in the stat word
+#define SM_QUEUE_SPIN 64
+#define SM_QUEUE_WAIT_NS 10000000 // 10ms
+#define SM_QUEUE_PUSHED 4 // word of the event bumped by pushes, on the producer line
+#define SM_QUEUE_POPPED (SM_QUEUE_LINE + 2) // word of the event bumped by pops, on the consumer line
 
 typedef struct {
     unsigned output_queue;
     unsigned output_entry;
 } sm_queue_entry_t;
 
+// Plain layout; the SPSC and MPMC layouts share its first three words
 typedef struct {
     uint64_t stat;
     uint64_t head;
-    uint64_t tail;
+    uint64_t tail; // SPSC layout: producer's cached copy of the tail
     uint64_t entry[SM_QUEUE_SIZE];
 } sm_queue_t;
 
+// Consumer line of the SPSC and MPMC layouts
+typedef struct {
+    uint64_t tail;
+    uint64_t head_cache; // SPSC only
+} sm_queue_cons_t;
+
+// Futex word and its sleepers
+typedef struct {
+    uint32_t seq;
+    uint32_t waiters;
+} sm_queue_event_t;
+
+// Entry of the MPMC layout
+typedef struct {
+    uint64_t seq;
+    uint64_t value;
+} sm_queue_cell_t;
+
+static inline bool sm_queue_valid_capacity(unsigned capacity) {
+    return capacity > 0 && capacity <= SM_QUEUE_MAX && (capacity & (capacity - 1)) == 0;
+}
+
+// Flags of the stat word; they are set before the queue is used and never change after
+static inline uint64_t sm_queue_flags(sm_queue_t *q) {
+    return __atomic_load_n(&(q->stat), __ATOMIC_RELAXED) & ~SM_QUEUE_STAT_MASK;
+}
+
+// Status (QUEUE_AVAIL or QUEUE_BUSY) set by the thread serving the queue
+static inline uint64_t sm_queue_get_stat(sm_queue_t *q) {
+    return __atomic_load_n(&(q->stat), __ATOMIC_SEQ_CST) & SM_QUEUE_STAT_MASK;
+}
+
+static inline void sm_queue_set_stat(sm_queue_t *q, uint64_t stat) {
+    __atomic_store_n(&(q->stat), sm_queue_flags(q) | stat, __ATOMIC_SEQ_CST);
+}
+
+static inline bool sm_queue_is_spsc(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_SPSC) != 0;
+}
+
+static inline bool sm_queue_is_mpmc(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_MPMC) != 0;
+}
+
+static inline bool sm_queue_is_blocking(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_BLOCK) != 0;
+}
+
+static inline unsigned sm_queue_capacity(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_LAYOUT) ? (unsigned) ((uint64_t *) q)[SM_QUEUE_CAPACITY] : SM_QUEUE_SIZE;
+}
+
+static inline sm_queue_cons_t *sm_queue_cons(sm_queue_t *q) {
+    return (sm_queue_cons_t *) ((uint64_t *) q + SM_QUEUE_LINE);
+}
+
+static inline uint64_t *sm_queue_tail_ptr(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_LAYOUT) ? &(sm_queue_cons(q)->tail) : &(q->tail);
+}
+
+static inline uint64_t *sm_queue_entries(sm_queue_t *q) {
+    return (sm_queue_flags(q) & SM_QUEUE_LAYOUT) ? (uint64_t *) q + 2 * SM_QUEUE_LINE : q->entry;
+}
+
+static inline sm_queue_cell_t *sm_queue_cells(sm_queue_t *q) {
+    return (sm_queue_cell_t *) sm_queue_entries(q);
+}
+
+// Slot of the entry at a head or tail position
+static inline unsigned sm_queue_slot(sm_queue_t *q, uint64_t pos) {
+    return (unsigned) (pos & (sm_queue_capacity(q) - 1));
+}
+
 static inline void sm_queue_init(sm_queue_t *q) {
     __atomic_store_n(&(q->stat), QUEUE_AVAIL, __ATOMIC_SEQ_CST);
     __atomic_store_n(&(q->head), 0, __ATOMIC_SEQ_CST);
@@ -28,39 +140,418 @@ static inline void sm_queue_init(sm_queue_t *q) {
     }
 }
 
+// q must start on a cache line and span SM_QUEUE_SPSC_WORDS(capacity)
+static inline void sm_queue_init_spsc(sm_queue_t *q, unsigned capacity) {
+    sm_queue_cons_t *c = sm_queue_cons(q);
+    __atomic_store_n(&(c->tail), 0, __ATOMIC_SEQ_CST);
+    c->head_cache = 0;
+    // Spare header words: the wait events and the stats link
+    memset((uint64_t *) q + SM_QUEUE_PUSHED, 0, (SM_QUEUE_LINE - SM_QUEUE_PUSHED) * sizeof(uint64_t));
+    memset((uint64_t *) q + SM_QUEUE_POPPED, 0, (2 * SM_QUEUE_LINE - SM_QUEUE_POPPED) * sizeof(uint64_t));
+    ((uint64_t *) q)[SM_QUEUE_CAPACITY] = capacity;
+    uint64_t *entry = (uint64_t *) q + 2 * SM_QUEUE_LINE; // stat does not name the layout yet
+    for (unsigned i = 0; i < capacity; i++) {
+        entry[i] = 0;
+    }
+    __atomic_store_n(&(q->tail), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(q->head), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(q->stat), QUEUE_AVAIL | SM_QUEUE_SPSC, __ATOMIC_SEQ_CST);
+}
+
+// q must start on a cache line and span SM_QUEUE_MPMC_WORDS(capacity), capacity >= SM_QUEUE_MPMC_MIN
+static inline void sm_queue_init_mpmc(sm_queue_t *q, unsigned capacity) {
+    sm_queue_cons_t *c = sm_queue_cons(q);
+    __atomic_store_n(&(c->tail), 0, __ATOMIC_SEQ_CST);
+    c->head_cache = 0;
+    // Spare header words: the wait events and the stats link
+    memset((uint64_t *) q + SM_QUEUE_PUSHED, 0, (SM_QUEUE_LINE - SM_QUEUE_PUSHED) * sizeof(uint64_t));
+    memset((uint64_t *) q + SM_QUEUE_POPPED, 0, (2 * SM_QUEUE_LINE - SM_QUEUE_POPPED) * sizeof(uint64_t));
+    ((uint64_t *) q)[SM_QUEUE_CAPACITY] = capacity;
+    sm_queue_cell_t *cell = (sm_queue_cell_t *) ((uint64_t *) q + 2 * SM_QUEUE_LINE);
+    for (unsigned i = 0; i < capacity; i++) {
+        cell[i].value = 0;
+        __atomic_store_n(&(cell[i].seq), i, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&(q->tail), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(q->head), 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&(q->stat), QUEUE_AVAIL | SM_QUEUE_MPMC, __ATOMIC_SEQ_CST);
+}
+
+// Make waits on an SPSC or MPMC queue sleep instead of spinning; set before the queue is used
+static inline void sm_queue_set_blocking(sm_queue_t *q) {
+    __atomic_fetch_or(&(q->stat), SM_QUEUE_BLOCK, __ATOMIC_SEQ_CST);
+}
+
+static inline sm_queue_event_t *sm_queue_event(sm_queue_t *q, unsigned event) {
+    return (sm_queue_event_t *) ((uint64_t *) q + event);
+}
+
+// Wake the sleepers of one side after moving the index the other side waits on
+static inline void sm_queue_notify(sm_queue_t *q, unsigned event) {
+    if (!sm_queue_is_blocking(q)) return;
+    sm_queue_event_t *ev = sm_queue_event(q, event);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // order the index update before reading waiters
+    if (__atomic_load_n(&(ev->waiters), __ATOMIC_RELAXED) == 0) return;
+    __atomic_fetch_add(&(ev->seq), 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &(ev->seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void sm_queue_sleep(sm_queue_event_t *ev, uint32_t key) {
+    struct timespec timeout = { 0, SM_QUEUE_WAIT_NS };
+    syscall(SYS_futex, &(ev->seq), FUTEX_WAIT_PRIVATE, key, &timeout, NULL, 0);
+}
+
+////////////////////////////////////
+// Telemetry (DO_QUEUE_STATS), for the SPSC and MPMC layouts: a stats block next to the queue,
+// with a producer part (pushes, occupancy, stalls waiting for room) and a consumer part (pops and
+// their push-to-pop residence), followed by the push time of the entry in each slot.
+
+#ifdef DO_QUEUE_STATS
+#define SM_QUEUE_STATS 5 // header word holding the distance from the queue to its stats, in uint64_t
+#define SM_QUEUE_HIST 12 // occupancy buckets: 0, 1, 2-3, 4-7, ... up to SM_QUEUE_MAX
+#define SM_QUEUE_STATS_WORDS(capacity) (2 * (3 * SM_QUEUE_LINE + (capacity))) // must start on a cache line
+
+typedef struct {
+    uint64_t pushes;
+    uint64_t max_level; // highest level right after a push
+    uint64_t full_stalls; // waits of producers for room
+    uint64_t full_stall_ns; // time spent in those waits
+    uint64_t hist[SM_QUEUE_HIST]; // entries ahead of each pushed entry
+    uint64_t pops;
+    uint64_t residence_ns; // push-to-pop time summed over popped entries
+    uint64_t residence_max_ns;
+    uint64_t pad[SM_QUEUE_LINE - 3];
+    uint64_t stamp[]; // push time of the entry in each slot
+} sm_queue_stats_t;
+
+static inline uint64_t sm_queue_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Stats of q, or NULL if it keeps none
+static inline sm_queue_stats_t *sm_queue_stats(sm_queue_t *q) {
+    if (!(sm_queue_flags(q) & SM_QUEUE_LAYOUT)) return NULL;
+    uint64_t dist = ((uint64_t *) q)[SM_QUEUE_STATS];
+    return dist ? (sm_queue_stats_t *) ((uint64_t *) q + dist) : NULL;
+}
+
+static inline void sm_queue_stats_reset(sm_queue_t *q) {
+    sm_queue_stats_t *st = sm_queue_stats(q);
+    if (st) memset(st, 0, sizeof(sm_queue_stats_t));
+}
+
+// Keep stats for q in st, which spans SM_QUEUE_STATS_WORDS and comes after q in memory
+static inline void sm_queue_attach_stats(sm_queue_t *q, sm_queue_stats_t *st) {
+    memset(st, 0, sizeof(sm_queue_stats_t) + sm_queue_capacity(q) * sizeof(uint64_t));
+    ((uint64_t *) q)[SM_QUEUE_STATS] = (uint64_t *) st - (uint64_t *) q;
+}
+
+static inline void sm_queue_stats_max(uint64_t *max, uint64_t value) {
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(max, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// n entries were written from position pos on; called before they are published
+static inline void sm_queue_stats_push(sm_queue_t *q, uint64_t pos, unsigned n) {
+    sm_queue_stats_t *st = sm_queue_stats(q);
+    if (!st) return;
+    uint64_t now = sm_queue_now();
+    unsigned level = (unsigned) (pos - __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE));
+    for (unsigned i = 0; i < n; i++) {
+        st->stamp[sm_queue_slot(q, pos + i)] = now;
+        unsigned bucket = (level + i) ? 64 - __builtin_clzll(level + i) : 0;
+        __atomic_fetch_add(&(st->hist[bucket]), 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&(st->pushes), n, __ATOMIC_RELAXED);
+    sm_queue_stats_max(&(st->max_level), level + n);
+}
+
+// n entries are about to be given back from position pos on
+static inline void sm_queue_stats_pop(sm_queue_t *q, uint64_t pos, unsigned n) {
+    sm_queue_stats_t *st = sm_queue_stats(q);
+    if (!st) return;
+    uint64_t now = sm_queue_now(), total = 0, max = 0;
+    for (unsigned i = 0; i < n; i++) {
+        uint64_t residence = now - st->stamp[sm_queue_slot(q, pos + i)];
+        total += residence;
+        if (residence > max) max = residence;
+    }
+    __atomic_fetch_add(&(st->pops), n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(st->residence_ns), total, __ATOMIC_RELAXED);
+    sm_queue_stats_max(&(st->residence_max_ns), max);
+}
+
+// Start and end of a wait in SM_QUEUE_WAIT_UNTIL; only producer waits for room are counted
+static inline uint64_t sm_queue_stats_wait(sm_queue_t *q, unsigned event) {
+    return (event == SM_QUEUE_POPPED && sm_queue_stats(q)) ? sm_queue_now() : 0;
+}
+
+static inline void sm_queue_stats_stall(sm_queue_t *q, uint64_t start) {
+    if (!start) return;
+    sm_queue_stats_t *st = sm_queue_stats(q);
+    __atomic_fetch_add(&(st->full_stalls), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(st->full_stall_ns), sm_queue_now() - start, __ATOMIC_RELAXED);
+}
+#else
+static inline void sm_queue_stats_push(sm_queue_t *q, uint64_t pos, unsigned n) { }
+static inline void sm_queue_stats_pop(sm_queue_t *q, uint64_t pos, unsigned n) { }
+static inline uint64_t sm_queue_stats_wait(sm_queue_t *q, unsigned event) { return 0; }
+static inline void sm_queue_stats_stall(sm_queue_t *q, uint64_t start) { }
+#endif // DO_QUEUE_STATS
+
+// Wait until cond holds; it is re-checked whenever event (SM_QUEUE_PUSHED for consumers,
+// SM_QUEUE_POPPED for producers) fires. cond may have side effects: the wait ends at the
+// first evaluation that returns true. Without SM_QUEUE_BLOCK this is the usual yield loop.
+#define SM_QUEUE_WAIT_UNTIL(q, event, cond) do { \
+    uint64_t _stall = 0; \
+    for (unsigned _spin = 0; !(cond); _spin++) { \
+        if (_spin == 0) _stall = sm_queue_stats_wait(q, event); \
+        if (!sm_queue_is_blocking(q) || _spin < SM_QUEUE_SPIN) { SCHED_YIELD; continue; } \
+        sm_queue_event_t *_ev = sm_queue_event(q, event); \
+        __atomic_fetch_add(&(_ev->waiters), 1, __ATOMIC_SEQ_CST); \
+        uint32_t _key = __atomic_load_n(&(_ev->seq), __ATOMIC_SEQ_CST); \
+        bool _done = (cond); \
+        if (!_done) sm_queue_sleep(_ev, _key); \
+        __atomic_fetch_sub(&(_ev->waiters), 1, __ATOMIC_RELAXED); \
+        if (_done) break; \
+    } \
+    sm_queue_stats_stall(q, _stall); \
+} while (0)
+
+// MPMC layout: number of consecutive entries from pos, up to n, whose sequence is pos + lag
+// -- lag 0 counts free entries from the head, lag 1 ready entries from the tail
+static inline unsigned sm_queue_turns(sm_queue_t *q, uint64_t pos, uint64_t lag, unsigned n) {
+    sm_queue_cell_t *cell = sm_queue_cells(q);
+    unsigned capacity = sm_queue_capacity(q);
+    if (n > capacity) n = capacity;
+    unsigned i = 0;
+    while (i < n && __atomic_load_n(&(cell[sm_queue_slot(q, pos + i)].seq), __ATOMIC_ACQUIRE) == pos + i + lag) i++;
+    return i;
+}
+
+// Producer side: free entries, refreshing the cached tail only if fewer than want look free
+static inline unsigned sm_queue_space(sm_queue_t *q, uint64_t head, unsigned want) {
+    if (sm_queue_is_mpmc(q)) return sm_queue_turns(q, head, 0, want);
+    unsigned capacity = sm_queue_capacity(q);
+    if (sm_queue_is_spsc(q)) {
+        unsigned space = capacity - (unsigned) (head - q->tail);
+        if (space >= want) return space;
+        q->tail = __atomic_load_n(&(sm_queue_cons(q)->tail), __ATOMIC_ACQUIRE);
+        return capacity - (unsigned) (head - q->tail);
+    }
+    uint64_t tail = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
+    return capacity - (unsigned) (head - tail);
+}
+
+// Consumer side: pending entries, refreshing the cached head only if fewer than want look pending
+static inline unsigned sm_queue_pending(sm_queue_t *q, uint64_t tail, unsigned want) {
+    if (sm_queue_is_mpmc(q)) return sm_queue_turns(q, tail, 1, want);
+    if (sm_queue_is_spsc(q)) {
+        sm_queue_cons_t *c = sm_queue_cons(q);
+        unsigned level = (unsigned) (c->head_cache - tail);
+        if (level >= want) return level;
+        c->head_cache = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+        return (unsigned) (c->head_cache - tail);
+    }
+    uint64_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+    return (unsigned) (head - tail);
+}
+
+// Entry at a head or tail position
+static inline uint64_t *sm_queue_at(sm_queue_t *q, uint64_t pos) {
+    if (sm_queue_is_mpmc(q)) return &(sm_queue_cells(q)[sm_queue_slot(q, pos)].value);
+    return &(sm_queue_entries(q)[sm_queue_slot(q, pos)]);
+}
+
+// Batched variants: move a run of entries with a single head or tail update
+// -- each returns how many entries it moved, which is limited by the free space
+// -- (push) or the pending entries (peek, pop); pop_n discards them when values is NULL.
+// -- On the MPMC layout push_n and pop_n may be called from several threads; peek_n and
+// -- the single-entry reads below assume the caller is the only consumer.
+static inline unsigned sm_queue_push_n(sm_queue_t *q, const uint64_t *values, unsigned n) {
+    uint64_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+    if (sm_queue_is_mpmc(q)) {
+        // Reserve a run of free entries, then hand each one to the consumers
+        for (;;) {
+            unsigned space = sm_queue_turns(q, head, 0, n);
+            if (space == 0) {
+                uint64_t cur = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+                if (cur == head) return 0;
+                head = cur;
+            } else if (__atomic_compare_exchange_n(&(q->head), &head, head + space, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                n = space;
+                break;
+            }
+        }
+        sm_queue_stats_push(q, head, n);
+        sm_queue_cell_t *cell = sm_queue_cells(q);
+        for (unsigned i = 0; i < n; i++) {
+            sm_queue_cell_t *c = &cell[sm_queue_slot(q, head + i)];
+            c->value = values[i];
+            __atomic_store_n(&(c->seq), head + i + 1, __ATOMIC_RELEASE);
+        }
+        sm_queue_notify(q, SM_QUEUE_PUSHED);
+        return n;
+    }
+    unsigned space = sm_queue_space(q, head, n);
+    if (n > space) n = space;
+    for (unsigned i = 0; i < n; i++) {
+        *sm_queue_at(q, head + i) = values[i];
+    }
+    if (n) {
+        sm_queue_stats_push(q, head, n);
+        __atomic_store_n(&(q->head), head + n, __ATOMIC_RELEASE);
+        sm_queue_notify(q, SM_QUEUE_PUSHED);
+    }
+    return n;
+}
+
+static inline unsigned sm_queue_peek_n(sm_queue_t *q, uint64_t *values, unsigned n) {
+    uint64_t tail = __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE);
+    unsigned level = sm_queue_pending(q, tail, n);
+    if (n > level) n = level;
+    for (unsigned i = 0; values && i < n; i++) {
+        values[i] = *sm_queue_at(q, tail + i);
+    }
+    return n;
+}
+
+static inline unsigned sm_queue_pop_n(sm_queue_t *q, uint64_t *values, unsigned n) {
+    uint64_t *tail_ptr = sm_queue_tail_ptr(q);
+    if (sm_queue_is_mpmc(q)) {
+        // Reserve a run of ready entries, then give each one back to the producers
+        uint64_t tail = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+        for (;;) {
+            unsigned level = sm_queue_turns(q, tail, 1, n);
+            if (level == 0) {
+                uint64_t cur = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+                if (cur == tail) return 0;
+                tail = cur;
+            } else if (__atomic_compare_exchange_n(tail_ptr, &tail, tail + level, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                n = level;
+                break;
+            }
+        }
+        sm_queue_stats_pop(q, tail, n);
+        sm_queue_cell_t *cell = sm_queue_cells(q);
+        for (unsigned i = 0; i < n; i++) {
+            sm_queue_cell_t *c = &cell[sm_queue_slot(q, tail + i)];
+            if (values) values[i] = c->value;
+            __atomic_store_n(&(c->seq), tail + i + sm_queue_capacity(q), __ATOMIC_RELEASE);
+        }
+        sm_queue_notify(q, SM_QUEUE_POPPED);
+        return n;
+    }
+    n = sm_queue_peek_n(q, values, n);
+    if (n) {
+        uint64_t tail = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+        sm_queue_stats_pop(q, tail, n);
+        __atomic_store_n(tail_ptr, tail + n, __ATOMIC_RELEASE);
+        sm_queue_notify(q, SM_QUEUE_POPPED);
+    }
+    return n;
+}
+
+// Single-entry variants; the caller checks full or empty first
 static inline void sm_queue_push(sm_queue_t *q, uint64_t value) {
+    if (sm_queue_is_mpmc(q)) {
+        while (!sm_queue_push_n(q, &value, 1)) { SCHED_YIELD; }
+        return;
+    }
     uint64_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
-    q->entry[head % SM_QUEUE_SIZE] = value;
+    *sm_queue_at(q, head) = value;
+    sm_queue_stats_push(q, head, 1);
     __atomic_store_n(&(q->head), head + 1, __ATOMIC_RELEASE);
+    sm_queue_notify(q, SM_QUEUE_PUSHED);
 }
 
 static inline uint64_t sm_queue_can_pop(sm_queue_t *q) {
-    uint64_t tail = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
-    return q->entry[tail % SM_QUEUE_SIZE];
+    uint64_t tail = __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE);
+    return *sm_queue_at(q, tail);
+}
+
+// Read the i-th pending entry from the tail without popping; caller checks the level first
+static inline uint64_t sm_queue_peek(sm_queue_t *q, unsigned i) {
+    uint64_t tail = __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE);
+    return *sm_queue_at(q, tail + i);
 }
 
 static inline uint64_t sm_queue_pop(sm_queue_t *q) {
-    uint64_t tail = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
-    uint64_t value = q->entry[tail % SM_QUEUE_SIZE];
-    __atomic_store_n(&(q->tail), tail + 1, __ATOMIC_RELEASE);
+    uint64_t value;
+    if (sm_queue_is_mpmc(q)) {
+        while (!sm_queue_pop_n(q, &value, 1)) { SCHED_YIELD; }
+        return value;
+    }
+    uint64_t *tail_ptr = sm_queue_tail_ptr(q);
+    uint64_t tail = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+    value = *sm_queue_at(q, tail);
+    sm_queue_stats_pop(q, tail, 1);
+    __atomic_store_n(tail_ptr, tail + 1, __ATOMIC_RELEASE);
+    sm_queue_notify(q, SM_QUEUE_POPPED);
     return value;
 }
 
-static inline bool sm_queue_empty(sm_queue_t *q) {
+// Consumer side, for readers that use an entry before giving its slot back: claim the entry
+// at the tail, then release its position when done. The producer cannot reuse the slot in
+// between, which is what lets several consumers share an MPMC queue; on the other layouts
+// this is a peek followed by a pop.
+static inline bool sm_queue_claim(sm_queue_t *q, uint64_t *pos, uint64_t *value) {
+    uint64_t *tail_ptr = sm_queue_tail_ptr(q);
+    uint64_t tail = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+    if (sm_queue_is_mpmc(q)) {
+        for (;;) {
+            if (sm_queue_turns(q, tail, 1, 1) == 0) {
+                uint64_t cur = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+                if (cur == tail) return false;
+                tail = cur;
+            } else if (__atomic_compare_exchange_n(tail_ptr, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+    } else if (sm_queue_pending(q, tail, 1) == 0) {
+        return false;
+    }
+    *pos = tail;
+    *value = *sm_queue_at(q, tail);
+    return true;
+}
+
+static inline void sm_queue_release(sm_queue_t *q, uint64_t pos) {
+    sm_queue_stats_pop(q, pos, 1);
+    if (sm_queue_is_mpmc(q)) {
+        __atomic_store_n(&(sm_queue_cells(q)[sm_queue_slot(q, pos)].seq), pos + sm_queue_capacity(q), __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(sm_queue_tail_ptr(q), pos + 1, __ATOMIC_RELEASE);
+    }
+    sm_queue_notify(q, SM_QUEUE_POPPED);
+}
+
+// Producer side: free entries, looking no further than want
+static inline unsigned sm_queue_room(sm_queue_t *q, unsigned want) {
     uint64_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
-    uint64_t tail = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
-    return (head == tail);
+    unsigned space = sm_queue_space(q, head, want);
+    return (space < want) ? space : want;
 }
 
+// Consumer-side check
+static inline bool sm_queue_empty(sm_queue_t *q) {
+    uint64_t tail = __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE);
+    return sm_queue_pending(q, tail, 1) == 0;
+}
+
+// Producer-side check
 static inline bool sm_queue_full(sm_queue_t *q) {
     uint64_t head = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
-    uint64_t tail = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
-    return (head - tail) >= SM_QUEUE_SIZE;
+    return sm_queue_space(q, head, 1) == 0;
 }
 
+// Level, safe from either side; reads both indices. Exact except on the MPMC layout, where it
+// also counts entries that are reserved but not yet written or given back.
 static inline unsigned sm_queue_level(sm_queue_t *q) {
     uint64_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
-    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(sm_queue_tail_ptr(q), __ATOMIC_ACQUIRE);
     return (unsigned)(head - tail);
 }
 
@@ -1,6 +1,8 @@
 #ifndef __NN_MODULE_H__
 #define __NN_MODULE_H__
 
+#include <stdlib.h>
+#include <pthread.h>
 #include <hpthread.h>
 #include <nn_graph.h>
 #include <gemm_queue.h>
@@ -20,15 +22,40 @@ typedef struct nn_task_descr {
 
 typedef struct gemm_task_descr {
     nn_task_descr common;
-    uint64_t descr_offset[SM_QUEUE_SIZE];
+    uint64_t descr_offset[]; // one per queue slot
 } gemm_task_descr;
 
-#define GEMM_TASK_DESCR_WORDS 12 // aligned as 4+8
+#define GEMM_TASK_DESCR_WORDS(depth) (4 + 2 * (depth)) // aligned as 4+2 per slot
+
+// Weights already resident in a memory pool, keyed by file and version (or seed)
+typedef struct nn_weight_entry {
+    char path[100]; // weight file; empty for synthetic weights
+    uint64_t key; // nn_weights_file_key() of the file, or the seed of synthetic weights
+    bool ready; // set once the module that added the entry has loaded it
+    unsigned len, prec; // tokens and storage precision
+    bool packed; // a panel-packed copy follows at packed_base
+    unsigned weight_base, packed_base; // offsets in the pool
+    int q_scale, q_zero; // quantization of the stored copy
+    struct nn_weight_entry *next;
+} nn_weight_entry;
+
+// Module memory; modules loaded from the same model file share one pool and its weights
+#define NN_MODULE_MEM_SIZE (8 * 1024 * 1024) // 8MB
+typedef struct nn_mem_pool {
+    char path[256]; // model file; empty for a private pool
+    void *mem;
+    unsigned size, allocated; // in words
+    unsigned refs; // modules using this pool
+    unsigned tenant_words; // largest private footprint of a module registered here
+    nn_weight_entry *weights; // guarded by the pool list lock; entries are loaded outside it
+    struct nn_mem_pool *next;
+} nn_mem_pool;
 
 // NN handle provides an API endpoint for registering and interacting with a model
 typedef struct {
     nn_graph_t *graph; // computational graph
     void *mem; // Memory handle for the module
+    nn_mem_pool *pool; // Pool that mem belongs to
     unsigned mem_allocated; // how much memory already allocated in this module
     sm_queue_t *input_queue, *output_queue; // Pointers to queues
     unsigned req_cnt;
@@ -36,8 +63,14 @@ typedef struct {
     unsigned nprio; // Priority: 1 (highest) - 10 (lowest)
     unsigned n_threads; // Default 0: as many as number of layers; for Mozart, allow user to set
     unsigned loop_around; // Number of times to loop around the queues
-    unsigned pending_requeues; // Number of pending requeues
+    unsigned queue_depth; // Capacity of every queue, i.e. requests in flight (power of two; SM_QUEUE_SIZE for plain queues)
+    uint64_t slots_reserved; // Input queue slots ever taken by admitted requests and their requeues
     bool cpu_invoke; // Should we invoke accelerator through CPU?
+    bool pack_weights; // Keep a panel-packed copy of the weights for the CPU GEMM path
+    bool share_weights; // Share memory and weights with other modules of the same model file
+    bool multi_client; // nn_module_req*/rsp* may be called from several threads at once
+    bool block_waits; // Sleep on futexes instead of spinning in queue waits (CPU-invoked modules without n_threads)
+    pthread_mutex_t req_lock, rsp_lock; // Serialize those clients on queues an accelerator reads
     #ifndef ENABLE_VAM
     physical_accel_t *accel_list;
     uint64_t active_cycles;
@@ -54,21 +87,45 @@ void nn_module_release(nn_module *m);
 void nn_module_setprio(nn_module *m, unsigned nprio);
 void nn_module_create_hpthread(nn_module *m);
 void nn_module_create_descr(nn_module *m);
+unsigned nn_module_hpthread_count(nn_module *m);
 static inline const char *nn_module_get_name(nn_module *m) { return m->graph->name; }
+// Do accelerator contexts poll this module's queues directly (no CPU thread between them)?
+static inline bool nn_module_accel_polls(nn_module *m) {
+    #ifdef ENABLE_VAM
+    return !m->cpu_invoke;
+    #else
+    return false;
+    #endif
+}
+
+// Words from the pool, not counted against any module
+static inline unsigned nn_mem_pool_malloc(nn_mem_pool *p, unsigned words) {
+    unsigned current_alloc = __atomic_fetch_add(&p->allocated, words, __ATOMIC_RELAXED);
+    if (current_alloc + words > p->size) {
+        printf("[NN] Module memory exhausted (%d of %d words)\n", current_alloc + words, p->size);
+        exit(1);
+    }
+    return current_alloc;
+}
 
 static inline unsigned nn_module_malloc(nn_module *m, unsigned words) {
-    unsigned current_alloc = m->mem_allocated;
     m->mem_allocated += words;
-    return current_alloc;
+    return nn_mem_pool_malloc(m->pool, words);
 }
 
 void nn_module_add_hpthread(nn_module *m, hpthread_t *th);
+hpthread_t **nn_module_hpthread_array(nn_module *m, bool pooled, unsigned *n);
 void nn_module_setpriority(nn_module *m, unsigned nprio);
 
 void nn_module_req(nn_module *m, nn_token_t *input_data, unsigned data_len, bool real_data);
 bool nn_module_req_check(nn_module *m, nn_token_t *input_data, unsigned data_len);
 void nn_module_rsp(nn_module *m, nn_token_t *output_data, unsigned data_len, bool real_data);
 bool nn_module_rsp_check(nn_module *m, nn_token_t *output_data, unsigned data_len);
+// Batched checks: send up to n requests / collect up to n ready responses with one queue update;
+// return how many requests were sent / completed. With "O clients <n>" (n > 1) all of these may be
+// called concurrently; responses are then handed out in completion order, not per caller.
+unsigned nn_module_req_check_n(nn_module *m, unsigned n);
+unsigned nn_module_rsp_check_n(nn_module *m, unsigned n);
 
 // Data structures for BFS traversal of NN graph
 typedef struct {
@@ -80,6 +137,15 @@ bool nn_set_add_node(nn_node_list **s, nn_node_t *n);
 static inline void nn_queue_delete(nn_queue_t *q) { while (nn_queue_pop(q) != NULL); }
 
 void initialize_data(const char *input_file, nn_token_t *mem, unsigned len);
+void initialize_random(nn_token_t *mem, unsigned len, unsigned seed);
+
+#ifdef DO_QUEUE_STATS
+// Queue telemetry per edge (NULL for queues in the plain layout, which keep none); the pipeline
+// walks start at the entry and follow the first out edge of every node
+sm_queue_stats_t *nn_module_edge_stats(nn_module *m, nn_edge_t *e);
+void nn_module_reset_queue_stats(nn_module *m);
+void nn_module_print_queue_stats(nn_module *m);
+#endif
 
 void nn_module_add_task_descr(nn_module *m, nn_task_descr *descr);
 void print_descr_list(nn_module *m);
@@ -1,10 +1,22 @@
 #ifndef NN_TOKEN_H
 #define NN_TOKEN_H
 
+#include <stdint.h>
+
 typedef struct {
     int32_t value; /* raw fixed-point: signed 16.16 */
 } nn_token_t;
 
+/* Quantized tokens: real value = scale * (value - zero_point), with the scale a raw 16.16
+   step and the zero point in quantized units, both held per layer */
+typedef struct {
+    int8_t value;
+} nn_token_q8_t;
+
+typedef struct {
+    int16_t value;
+} nn_token_q16_t;
+
 /* Constants (mirroring static constexpr in C++) */
 enum { NN_FRACTIONAL_BITS = 16 };
 enum { NN_SCALE = 1 << NN_FRACTIONAL_BITS };
@@ -50,6 +62,51 @@ static inline nn_token_t nn_token_div(nn_token_t a, nn_token_t b) {
     return nn_token_from_raw((int32_t)(num / (int64_t) b.value));
 }
 
+/* Rescale a wide accumulator (sum of raw 32.32 products) back to 16.16 once,
+   rounding to nearest and saturating to the int32 range */
+static inline nn_token_t nn_token_from_acc(int64_t acc) {
+    int64_t raw = (acc + (1LL << (NN_FRACTIONAL_BITS - 1))) >> NN_FRACTIONAL_BITS;
+    if (raw > INT32_MAX) raw = INT32_MAX;
+    if (raw < INT32_MIN) raw = INT32_MIN;
+    return nn_token_from_raw((int32_t) raw);
+}
+
+/* Rescale a wide accumulator of (16.16 x quantized) products by the quantization step,
+   rounding to nearest and saturating; equals nn_token_from_acc() on dequantized weights */
+static inline nn_token_t nn_token_from_qacc(int64_t acc, int32_t scale) {
+    __int128 raw = ((__int128) acc * scale + (1LL << (NN_FRACTIONAL_BITS - 1))) >> NN_FRACTIONAL_BITS;
+    if (raw > INT32_MAX) raw = INT32_MAX;
+    if (raw < INT32_MIN) raw = INT32_MIN;
+    return nn_token_from_raw((int32_t) raw);
+}
+
+/* Quantize to the nearest step in [qmin, qmax]; scale must be positive */
+static inline int32_t nn_token_quantize(nn_token_t t, int32_t scale, int32_t zero_point, int32_t qmin, int32_t qmax) {
+    int64_t q = (int64_t) t.value >= 0 ? ((int64_t) t.value + scale / 2) / scale : -((-(int64_t) t.value + scale / 2) / scale);
+    q += zero_point;
+    if (q < qmin) q = qmin;
+    if (q > qmax) q = qmax;
+    return (int32_t) q;
+}
+static inline nn_token_t nn_token_dequantize(int32_t q, int32_t scale, int32_t zero_point) {
+    int64_t raw = (int64_t) scale * (q - zero_point);
+    if (raw > INT32_MAX) raw = INT32_MAX;
+    if (raw < INT32_MIN) raw = INT32_MIN;
+    return nn_token_from_raw((int32_t) raw);
+}
+static inline nn_token_q8_t nn_token_to_q8(nn_token_t t, int32_t scale, int32_t zero_point) {
+    nn_token_q8_t q; q.value = (int8_t) nn_token_quantize(t, scale, zero_point, INT8_MIN, INT8_MAX); return q;
+}
+static inline nn_token_q16_t nn_token_to_q16(nn_token_t t, int32_t scale, int32_t zero_point) {
+    nn_token_q16_t q; q.value = (int16_t) nn_token_quantize(t, scale, zero_point, INT16_MIN, INT16_MAX); return q;
+}
+static inline nn_token_t nn_token_from_q8(nn_token_q8_t q, int32_t scale, int32_t zero_point) {
+    return nn_token_dequantize(q.value, scale, zero_point);
+}
+static inline nn_token_t nn_token_from_q16(nn_token_q16_t q, int32_t scale, int32_t zero_point) {
+    return nn_token_dequantize(q.value, scale, zero_point);
+}
+
 /* Compound assignment */
 static inline void nn_token_iadd(nn_token_t* a, nn_token_t b) {
     a->value += b.value;
@@ -87,4 +144,9 @@ static inline nn_token_t nn_token_from_float_rn(float f) {
     return nn_token_from_raw(raw);
 }
 
+/* Bulk conversions (SIMD where available, same results as the per-element helpers above) */
+void nn_tokens_from_floats(nn_token_t* dst, const float* src, unsigned len);
+void nn_tokens_from_floats_rn(nn_token_t* dst, const float* src, unsigned len);
+void nn_tokens_to_floats(float* dst, const nn_token_t* src, unsigned len);
+
 #endif /* NN_TOKEN_H */
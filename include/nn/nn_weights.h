@@ -0,0 +1,37 @@
+#ifndef __NN_WEIGHTS_H__
+#define __NN_WEIGHTS_H__
+
+#include <stdint.h>
+#include <nn_token.h>
+
+// Binary weight container: a fixed header followed by the raw tokens, so a layer can be
+// loaded by mapping the file and copying it straight into module memory
+#define NN_WEIGHTS_MAGIC "NNWT"
+#define NN_WEIGHTS_VERSION 1
+#define NN_WEIGHTS_Q16_16 0 // dtype: nn_token_t, signed 16.16
+#define NN_WEIGHTS_LANES 4 // interleaved checksum lanes
+
+typedef struct {
+    char magic[4]; // NN_WEIGHTS_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t rows, cols; // shape, rows * cols tokens follow
+    uint32_t data_offset; // bytes from the start of the file to the first token
+    uint64_t checksum; // nn_weights_checksum() of the tokens
+} nn_weights_header_t;
+
+// Fletcher-style sum over NN_WEIGHTS_LANES interleaved word lanes (lane = index % lanes)
+uint64_t nn_weights_checksum(const nn_token_t *data, unsigned len);
+
+// Copy len tokens from a binary weight file into dst, checking shape and checksum;
+// returns 0 on success, 1 if path is not a binary weight file and -1 if it is invalid
+int nn_weights_load(const char *path, nn_token_t *dst, unsigned len);
+
+// Cache key of a weight file: the header checksum for binary files, and the size and
+// modification time (from stat) for text files, which are not read; 0 if it cannot be opened
+uint64_t nn_weights_file_key(const char *path);
+
+// Write rows x cols tokens as a binary weight file; returns 0 on success
+int nn_weights_write(const char *path, const nn_token_t *data, unsigned rows, unsigned cols);
+
+#endif // __NN_WEIGHTS_H__
@@ -1,10 +1,125 @@
 #ifndef __SW_GEMM_H__
 #define __SW_GEMM_H__
 
+#include <stdbool.h>
+#include <nn_token.h>
+#include <gemm_params.h>
+
+// Accumulation modes for the software GEMM
+#define GEMM_ACCUM_NARROW 0 // Shift and truncate every product, like nn_token_mul
+#define GEMM_ACCUM_WIDE 1 // Keep 64-bit partial sums; round and saturate once per output
+
+// Maximum number of queued tasks the CPU worker runs in one batched pass
+#define GEMM_BATCH_MAX 16
+
+// Loop orders over the tiles of C
+#define GEMM_ORDER_N_OUTER 0 // Column tiles outermost: a block of B stays hot while A streams
+#define GEMM_ORDER_M_OUTER 1 // Row tiles outermost: a block of A stays hot while B streams
+
+// Tuned configuration for one (m, n, k); a zero field keeps the built-in choice
+typedef struct {
+    unsigned dim_m, dim_n, dim_k;
+    unsigned tile_m; // Rows of C per tile (multiple of the register block height)
+    unsigned tile_n; // Columns of C per tile (multiple of the register block width)
+    unsigned order; // GEMM_ORDER_*
+    unsigned threads; // Pool threads used by gemm_parallel(), including the caller
+} gemm_tune_t;
+
+// Per-call options for gemm_ex(); passing NULL uses the process defaults
+typedef struct {
+    unsigned accum; // GEMM_ACCUM_*
+    const nn_token_t *packed_b; // B pre-packed with gemm_pack_b; when set, B is not read
+    // Fused epilogue, applied to each block of C right after it is computed
+    const nn_token_t *bias; // n values added to every row of C, or NULL
+    unsigned act; // GEMM_ACT_*; GEMM_ACT_SAT also forces wide accumulation
+    nn_token_t act_lo, act_hi; // Bounds for GEMM_ACT_CLAMP
+    // Quantized weights: for GEMM_PREC_Q16/Q8, B points at k x n quantized values (packed_b is ignored)
+    // and the product is always accumulated wide
+    unsigned prec; // GEMM_PREC_*
+    int32_t q_scale, q_zero; // Per-layer step and zero point of B
+    const gemm_tune_t *tune; // Tuned configuration for this shape, resolved once by the caller; NULL keeps the built-in choice
+} gemm_opts_t;
+
+// Process defaults (what a NULL opts means) with the given tuned configuration
+void gemm_opts_default(gemm_opts_t *opts, const gemm_tune_t *tune);
+
+static inline bool gemm_opts_has_epilogue(const gemm_opts_t *opts) {
+    return opts && (opts->bias || opts->act == GEMM_ACT_RELU || opts->act == GEMM_ACT_CLAMP);
+}
+
 // Wrapper for GEMM to be mapped for the hpthread
 void *sw_gemm(void *a);
 
 // Tiled matrix multiply
 void gemm(const nn_token_t* A, const nn_token_t* B, nn_token_t* C, unsigned m, unsigned n, unsigned k);
+void gemm_ex(const nn_token_t* A, const nn_token_t* B, nn_token_t* C, unsigned m, unsigned n, unsigned k, const gemm_opts_t *opts);
+
+// Multi-threaded GEMM on the persistent worker pool; runs inline when the pool is disabled,
+// busy with another call, or the problem is too small to split
+void gemm_parallel(const nn_token_t* A, const nn_token_t* B, nn_token_t* C, unsigned m, unsigned n, unsigned k, const gemm_opts_t *opts);
+
+// Worker pool size, including the calling thread: 1 disables the pool, 0 uses every online CPU.
+// Changing it tears down the running pool; workers are started on the next gemm_parallel().
+void gemm_pool_setthreads(unsigned n_threads);
+unsigned gemm_pool_getthreads();
+void gemm_pool_release();
+
+// Batched GEMM: C[i] = A[i] * B for i < batch, all with the same m, n, k; each column panel
+// of B is streamed once per batch instead of once per request
+void gemm_batched(const nn_token_t* const* A, const nn_token_t* B, nn_token_t* const* C, unsigned batch,
+                  unsigned m, unsigned n, unsigned k, const gemm_opts_t *opts);
+
+// Pack B (k x n, row-major) into contiguous column panels of the microkernel width
+unsigned gemm_packed_size(unsigned n, unsigned k);
+void gemm_pack_b(const nn_token_t* B, nn_token_t* packed, unsigned n, unsigned k);
+
+// Size in words of count weights stored at precision prec
+unsigned gemm_quant_size(unsigned prec, unsigned count);
+// Quantize count weights to prec with a per-layer asymmetric range; returns the step and zero point
+void gemm_quantize_b(const nn_token_t* B, void* quant, unsigned prec, unsigned count, int32_t *scale, int32_t *zero_point);
+
+// Apply only the bias and activation in opts to an m x n output (e.g. after an accelerator ran the GEMM)
+void gemm_epilogue(nn_token_t* C, unsigned m, unsigned n, const gemm_opts_t *opts);
+
+// Options for the task described by params; offsets are relative to mem
+void gemm_params_opts(nn_token_t *mem, const gemm_params_t *params, gemm_opts_t *opts);
+// Run the GEMM task described by params on the CPU
+void gemm_params_run(nn_token_t *mem, const gemm_params_t *params);
+// Apply the task's bias and activation to an output computed without them
+void gemm_params_epilogue(nn_token_t *mem, const gemm_params_t *params);
+// Run several tasks of the same layer together; see gemm_params_batchable()
+void gemm_params_run_batched(nn_token_t *mem, const gemm_params_t* const* params, unsigned batch);
+// Can two tasks share one pass over the weights?
+static inline bool gemm_params_batchable(const gemm_params_t *a, const gemm_params_t *b) {
+    return a->weight_base == b->weight_base && a->dim_m == b->dim_m && a->dim_n == b->dim_n &&
+           a->dim_k == b->dim_k && a->flags == b->flags && a->packed_base == b->packed_base &&
+           a->bias_base == b->bias_base && a->act == b->act && a->act_lo == b->act_lo && a->act_hi == b->act_hi &&
+           a->prec == b->prec && a->q_scale == b->q_scale && a->q_zero == b->q_zero;
+}
+
+// Tuning table, loaded on the first GEMM call from $GEMM_TUNE_FILE or GEMM_TUNE_FILE
+#ifndef GEMM_TUNE_FILE
+#define GEMM_TUNE_FILE "gemm.tune"
+#endif
+#define GEMM_TUNE_MAX 128
+// Slot of the shape's entry (0 if none); layers resolve it once and keep it in their params
+unsigned gemm_tune_slot(unsigned m, unsigned n, unsigned k);
+// Entry in a resolved slot, or NULL if the slot no longer holds this shape
+const gemm_tune_t *gemm_tune_get(unsigned slot, unsigned m, unsigned n, unsigned k);
+// Entry for the shape, or NULL to use the defaults; scans the table, so keep it off per-call paths
+const gemm_tune_t *gemm_tune_lookup(unsigned m, unsigned n, unsigned k);
+// Add or replace the entry for cfg's shape; running GEMMs keep the copy they already resolved
+void gemm_tune_set(const gemm_tune_t *cfg);
+void gemm_tune_clear();
+// Read/write a tuning file ("m n k tile_m tile_n order threads" per line); return the number of entries or -1
+int gemm_tune_load(const char *path);
+int gemm_tune_save(const char *path);
+// Sweep tiles, loop orders and thread counts for one shape, keep the fastest configuration in
+// the table and return it in best; each candidate is timed as the best of reps runs
+void gemm_tune_shape(unsigned m, unsigned n, unsigned k, unsigned reps, gemm_tune_t *best);
+
+// Process-wide accumulation mode used by gemm() and the CPU worker
+void gemm_setaccum(unsigned mode);
+unsigned gemm_getaccum();
 
 #endif // __SW_GEMM_H__
@@ -0,0 +1,70 @@
+#ifndef __SW_GEMM_KERNELS_H__
+#define __SW_GEMM_KERNELS_H__
+
+#include <stdint.h>
+#include <sw_gemm.h>
+
+// Register block computed by one microkernel call: GEMM_MR rows x GEMM_NR columns of C
+#define GEMM_MR 4
+#define GEMM_NR 16
+
+// Microkernel: C[0:mr, 0:nr] = A[0:mr, 0:k] * B[0:k, 0:nr] over raw 16.16 values
+// -- lda/ldb/ldc are the row strides (in elements) of A, B and C
+// -- mr <= GEMM_MR and nr <= GEMM_NR; vector kernels fall back to scalar for partial tiles
+typedef void (*gemm_ukernel_t)(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                               int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr);
+
+// Quantized microkernel: C[0:mr, 0:nr] = A * (B - zero) * scale, B holding 8- or 16-bit values;
+// accumulates in 64 bits and rounds like the wide kernel
+typedef void (*gemm_qukernel_t)(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero);
+
+// Matrix-vector kernel for n == 1: y[0:rows] = A[0:rows, 0:k] * x[0:k]
+typedef void (*gemm_mv_t)(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k);
+// Vector-matrix kernel for m == 1: y[0:n] = x[0:k] * B[0:k, 0:n]
+typedef void (*gemm_vm_t)(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k);
+
+// Fully unrolled kernels for the square layer sizes our models use: 16, 32, 48, 64
+#define GEMM_FIXED_STEP 16
+#define GEMM_FIXED_COUNT 4
+// C = A * B for one fixed S x S x S shape; B is read from packed panels when packed != NULL
+typedef void (*gemm_fixed_t)(const int32_t *a, const int32_t *b, const int32_t *packed, int32_t *c);
+
+// Slot of the fixed-shape kernel for (m, n, k), or -1 for the generic path
+static inline int gemm_fixed_index(unsigned m, unsigned n, unsigned k) {
+    if (m != n || n != k || m == 0 || m % GEMM_FIXED_STEP || m > GEMM_FIXED_STEP * GEMM_FIXED_COUNT) return -1;
+    return m / GEMM_FIXED_STEP - 1;
+}
+
+// Set of microkernels for one instruction set
+typedef struct {
+    const char *name; // ISA name, for debug
+    gemm_ukernel_t narrow; // Rescale every product (matches nn_token_mul)
+    gemm_ukernel_t wide; // 64-bit sums over k, rescaled once per output (nn_token_from_acc)
+    gemm_mv_t mv_narrow, mv_wide; // GEMV fast paths, same rounding as narrow/wide
+    gemm_vm_t vm_narrow, vm_wide;
+    gemm_fixed_t fixed_narrow[GEMM_FIXED_COUNT], fixed_wide[GEMM_FIXED_COUNT]; // Indexed by gemm_fixed_index()
+    gemm_qukernel_t q16, q8; // Quantized weights (GEMM_PREC_Q16/Q8)
+} gemm_kernel_ops_t;
+
+// Select the best microkernels for the host at runtime (cached after the first call)
+const gemm_kernel_ops_t *gemm_get_kernel();
+
+// Does opts select wide accumulation (process default when NULL)?
+bool gemm_opts_wide(const gemm_opts_t *opts);
+// Microkernel for the accumulation mode in opts
+gemm_ukernel_t gemm_select_ukernel(const gemm_opts_t *opts);
+
+// Compute the C[m0:m1, n0:n1] sub-block; B is read from packed panels when packed != NULL.
+// The epilogue in epi (if not NULL) is applied to each register block after it is stored.
+void gemm_block(gemm_ukernel_t ukernel, const int32_t *a, const int32_t *b, const int32_t *packed, int32_t *c,
+                unsigned dim_n, unsigned dim_k, unsigned m0, unsigned m1, unsigned n0, unsigned n1, const gemm_opts_t *epi);
+
+// gemm_block() for quantized B; the precision, scale and zero point are taken from opts
+void gemm_qblock(const gemm_opts_t *opts, const int32_t *a, const void *b, int32_t *c,
+                 unsigned dim_n, unsigned dim_k, unsigned m0, unsigned m1, unsigned n0, unsigned n1, const gemm_opts_t *epi);
+
+// Bias and activation on an mr x nr block of C whose first column is n0
+void gemm_epilogue_block(int32_t *c, unsigned ldc, unsigned mr, unsigned nr, unsigned n0, const gemm_opts_t *epi);
+
+#endif // __SW_GEMM_KERNELS_H__
@@ -4,7 +4,7 @@
 // VAM backend is responsible for map virutal hpthreads to physical accelerators
 // (or CPU threads) and tracking utilization of these mappings
 
-#define VAM_SLEEP       250000 // 250ms
+#define VAM_SLEEP       250000 // 250ms, period of the load balancer
 // Default scheduling period of AVU
 #define AVU_SCHED_PERIOD    0x1000000
 // Cooldown timer for migration
@@ -14,8 +14,16 @@
 void vam_wakeup();
 // Main run method
 void *vam_run_backend(void *arg);
+#ifdef DO_CPU_PIN
+// Next core to pin a new thread to, shared with the GEMM pool
+unsigned vam_next_core();
+#endif
 // Search for accelerator candidates for the hpthread
 void vam_search_accel(hpthread_t *th);
+// Same for n hpthreads, placed one after the other against a single utilization sample
+void vam_search_accel_n(hpthread_t **th, unsigned n);
+// Pick an accelerator and context for the hpthread using the last utilization sample, and configure it
+void vam_place_accel(hpthread_t *th);
 // Once accelerator candidate is identified, configure the accelerator
 void vam_configure_accel(hpthread_t *th, physical_accel_t *accel, unsigned context);
 // Launch a CPU thread for invoking the accelerator
@@ -24,12 +32,17 @@ void vam_configure_cpu_invoke(hpthread_t *th, physical_accel_t *accel, unsigned
 void vam_configure_cpu(hpthread_t *th, physical_accel_t *accel);
 // Release the accelerator allocated to the hpthread
 void vam_release_accel(hpthread_t *th);
+// Point the context allocated to the hpthread at a new memory pool and queue
+void vam_rebind_accel(hpthread_t *th, hpthread_args_t *args);
 // Set a new priority for the accelerator allocated to the hpthread
 void vam_setprio_accel(hpthread_t *th);
+// Publish the accelerator snapshot table read by hpthread_snapshot()
+void vam_publish_snapshot();
 // Insert a new physical accelerator struct or CPU thread
 void insert_physical_accel(physical_accel_t *accel);
 void insert_hpthread_cand(hpthread_cand_t *cand);
 void insert_cpu_thread(physical_accel_t *accel);
+void remove_cpu_thread(physical_accel_t *accel);
 // Update utilization metrics for all accelerators
 void vam_check_utilization();
 // Checks whether the load is balanced across all acclerators
@@ -2,67 +2,314 @@
 #include <hpthread.h>
 #include <hpthread_intf.h>
 #include <vam_backend.h>
+#include <vam_physical_accel.h>
 #include <sched.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sm_queue.h>
+#include <libesp.h>
 
-// External instance of hpthread interface
-extern hpthread_intf_t intf;
 // Helper function to wake up VAM, if not started already
 extern void wakeup_vam();
 // Running thread counter
 static unsigned thread_count = 0;
 
+// Park queues of a pool entry, in words: a blocking SPSC queue for hpthreads run by a CPU thread,
+// so that they sleep while parked, then a plain one for the accelerators, which poll that layout
+#define POOL_PARK_CPU_WORDS ((SM_QUEUE_SPSC_WORDS(1) + SM_QUEUE_LINE_WORDS - 1) / SM_QUEUE_LINE_WORDS * SM_QUEUE_LINE_WORDS)
+#define POOL_PARK_WORDS (POOL_PARK_CPU_WORDS + SM_QUEUE_LINE_WORDS)
+
+// Park queues of the hpthreads added by one hpthread_pool_fill()
+typedef struct {
+	void *mem;
+	unsigned live; // entries not drained yet
+} hpthread_pool_batch_t;
+
+// Warm pool entry: a pooled hpthread with the args it owns and the queue it parks on
+typedef struct hpthread_pool_entry_t {
+	hpthread_t th; // first, so a pooled hpthread can be cast back to its entry
+	hpthread_args_t args; // current binding; rebinding copies into it
+	hpthread_args_t park; // binding while parked
+	hpthread_pool_batch_t *batch;
+	struct hpthread_pool_entry_t *next;
+} hpthread_pool_entry_t;
+// Parked hpthreads, of all primitives
+static hpthread_pool_entry_t *pool_list = NULL;
+static unsigned pool_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// If VAM has not yet been started (i.e., interface is in vam_state_t::RESET, start one thread now)
+static void hpthread_start_vam() {
+    if (hpthread_intf_swap(VAM_RESET, VAM_WAKEUP)) {
+		// Only one thread should enter here; requests from the others wait in the ring
+		wakeup_vam();
+		hpthread_intf_set(VAM_IDLE);
+    }
+}
+
+// Queue a request for VAM
+static void hpthread_submit(hpthread_req_t *req, uint8_t op, hpthread_t **th, unsigned n) {
+	req->op = op;
+	req->th = th;
+	req->n = n;
+	hpthread_intf_submit(req);
+}
+
+// Queue a request for VAM and block until it is complete
+static void hpthread_request(hpthread_req_t *req, uint8_t op, hpthread_t **th, unsigned n) {
+	hpthread_submit(req, op, th, n);
+	hpthread_intf_wait(req);
+}
+
+// Assign IDs to a batch of hpthreads and queue the request that creates them
+static void hpthread_create_submit(hpthread_req_t *req, hpthread_t **th, unsigned n) {
+	for (unsigned i = 0; i < n; i++) {
+		// Assign a thread ID
+		th[i]->id = __atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+		HIGH_DEBUG(printf("[HPTHREAD] Requested hpthread %s (ID:%d).\n", th[i]->name, th[i]->id);)
+	}
+
+	hpthread_start_vam();
+
+	// One request places the whole batch
+	hpthread_submit(req, VAM_CREATE, th, n);
+}
+
+// Mark the hpthreads of a completed create request active
+static void hpthread_create_finish(hpthread_req_t *req) {
+	uint64_t now = get_counter();
+	for (unsigned i = 0; i < req->n; i++) {
+		HIGH_DEBUG(printf("[HPTHREAD] Received hpthread %s.\n", req->th[i]->name);)
+		req->th[i]->is_active = true;
+		req->th[i]->th_last_move = now;
+	}
+}
+
 void hpthread_init(hpthread_t *th, unsigned user_id) {
 	th->is_active = false;
 	th->user_id = user_id;
 	th->affinity = 0; // No preference by default
+	th->pooled = false;
 }
 
 void hpthread_create(hpthread_t *th) {
-	// Assign a thread ID
-	th->id = ++thread_count;
-	HIGH_DEBUG(printf("[HPTHREAD] Requested hpthread %s (ID:%d).\n", th->name, th->id);)
+	hpthread_create_n(&th, 1);
+}
 
-    // If VAM has not yet been started (i.e., interface is in vam_state_t::RESET, start one thread now)
-    if (hpthread_intf_swap(VAM_RESET, VAM_WAKEUP)) {
-		// Only one thread should enter here; remaining will wait for idle state
-		wakeup_vam();
-		hpthread_intf_set(VAM_IDLE);
-    }
+void hpthread_create_n(hpthread_t **th, unsigned n) {
+	if (n == 0) return;
+	hpthread_req_t req;
+	hpthread_create_submit(&req, th, n);
+	hpthread_intf_wait(&req);
+	hpthread_create_finish(&req);
+}
+
+hpthread_req_t *hpthread_create_async(hpthread_t *th) {
+	hpthread_req_t *req = (hpthread_req_t *) malloc(sizeof(hpthread_req_t));
+	// The handle keeps its own copy of the pointer, since &th does not outlive this call
+	req->single = th;
+	hpthread_create_submit(req, &req->single, 1);
+	return req;
+}
 
-	// Check if the interface is IDLE. If yes, swap to BUSY. If not, block until it is
-	while (!hpthread_intf_swap(VAM_IDLE, VAM_BUSY)) SCHED_YIELD;
-	// Write the hpthread request to the interface
-	intf.th = th;
-	// Set the interface state to CREATE
-    hpthread_intf_set(VAM_CREATE);
-	// Block until the request is complete (interface state is DONE), then swap to IDLE
-	while (!hpthread_intf_swap(VAM_DONE, VAM_IDLE)) SCHED_YIELD;
-	HIGH_DEBUG(printf("[HPTHREAD] Received hpthread %s.\n", th->name);)
-	th->is_active = true;
-    th->th_last_move = get_counter();
+hpthread_req_t *hpthread_create_n_async(hpthread_t **th, unsigned n) {
+	hpthread_req_t *req = (hpthread_req_t *) malloc(sizeof(hpthread_req_t));
+	if (n == 0) {
+		// Nothing to place; the handle is complete from the start
+		req->th = th;
+		req->n = 0;
+		req->done = 1;
+		return req;
+	}
+	hpthread_create_submit(req, th, n);
+	return req;
+}
+
+bool hpthread_test(hpthread_req_t *req) {
+	return __atomic_load_n(&(req->done), __ATOMIC_ACQUIRE);
+}
+
+void hpthread_wait(hpthread_req_t *req) {
+	hpthread_intf_wait(req);
+	hpthread_create_finish(req);
+	free(req);
 }
 
 int hpthread_join(hpthread_t *th) {
-	HIGH_DEBUG(printf("[HPTHREAD] Joining hpthread %s.\n", th->name);)
+	return hpthread_join_n(&th, 1);
+}
+
+int hpthread_join_n(hpthread_t **th, unsigned n) {
+	if (n == 0) return 0;
+	HIGH_DEBUG(printf("[HPTHREAD] Joining %d hpthread(s) from %s.\n", n, th[0]->name);)
 
 	// If the interface is vam_state_t::RESET, return an error
     if (hpthread_intf_test() == VAM_RESET) return 1;
 
-	// Check if the interface is IDLE. If yes, swap to BUSY. If not, block until it is
-	while (!hpthread_intf_swap(VAM_IDLE, VAM_BUSY)) SCHED_YIELD;
-	// Write the hpthread request to the interface
-	intf.th = th;
-	// Set the interface state to JOIN
-    hpthread_intf_set(VAM_JOIN);
-	// Block until the request is complete (interface state is DONE), then swap to IDLE
-	while (!hpthread_intf_swap(VAM_DONE, VAM_IDLE)) SCHED_YIELD;
-	HIGH_DEBUG(printf("[HPTHREAD] Join hpthread complete %s.\n", th->name);)
-	th->is_active = false;
+	hpthread_req_t req;
+	hpthread_request(&req, VAM_JOIN, th, n);
+	for (unsigned i = 0; i < n; i++) {
+		HIGH_DEBUG(printf("[HPTHREAD] Join hpthread complete %s.\n", th[i]->name);)
+		th[i]->is_active = false;
+	}
 	return 0;
 }
 
+// Wait until the workers of the hpthreads have switched to their current bindings
+static void hpthread_bind_wait(hpthread_t **th, unsigned n) {
+	for (unsigned i = 0; i < n; i++) {
+		hpthread_args_t *a = th[i]->args;
+		while (__atomic_load_n(&(a->bind_ack), __ATOMIC_ACQUIRE) != a->bind_seq) SCHED_YIELD;
+	}
+}
+
+void hpthread_rebind(hpthread_t *th, hpthread_args_t *args) {
+	hpthread_rebind_n(&th, &args, 1);
+}
+
+void hpthread_rebind_n(hpthread_t **th, hpthread_args_t **args, unsigned n) {
+	if (n == 0) return;
+	HIGH_DEBUG(printf("[HPTHREAD] Rebinding %d hpthread(s) from %s to queue %d.\n", n, th[0]->name, args[0]->queue_ptr);)
+	// The worker of a new hpthread may not have picked up its first binding yet
+	hpthread_bind_wait(th, n);
+	hpthread_req_t req;
+	req.args = args;
+	hpthread_request(&req, VAM_REBIND, th, n);
+	// Workers driven by a CPU thread switch at their next safe point; wait for them
+	hpthread_bind_wait(th, n);
+	HIGH_DEBUG(printf("[HPTHREAD] Rebind complete for %d hpthread(s).\n", n);)
+}
+
+void hpthread_pool_fill(hpthread_prim_t prim, bool cpu_invoke, unsigned nprio, unsigned n) {
+	if (n == 0) return;
+	hpthread_pool_entry_t **e = (hpthread_pool_entry_t **) malloc(n * sizeof(hpthread_pool_entry_t *));
+	hpthread_t **th = (hpthread_t **) malloc(n * sizeof(hpthread_t *));
+	// Each parked hpthread waits on an empty queue of its own, in memory the accelerators can reach
+	hpthread_pool_batch_t *batch = (hpthread_pool_batch_t *) malloc(sizeof(hpthread_pool_batch_t));
+	batch->mem = esp_alloc(n * POOL_PARK_WORDS * sizeof(unsigned));
+	batch->live = n;
+	for (unsigned i = 0; i < n; i++) {
+		e[i] = (hpthread_pool_entry_t *) malloc(sizeof(hpthread_pool_entry_t));
+		unsigned park_cpu = i * POOL_PARK_WORDS;
+		sm_queue_t *q = (sm_queue_t *) ((unsigned *) batch->mem + park_cpu);
+		sm_queue_init_spsc(q, 1);
+		sm_queue_set_blocking(q);
+		sm_queue_init((sm_queue_t *) ((unsigned *) batch->mem + park_cpu + POOL_PARK_CPU_WORDS));
+		e[i]->batch = batch;
+		e[i]->park.mem = batch->mem;
+		// CPU-invoked hpthreads always run on a CPU thread; the others start on the plain queue
+		e[i]->park.queue_ptr = cpu_invoke ? park_cpu : park_cpu + POOL_PARK_CPU_WORDS;
+		e[i]->args = e[i]->park;
+		hpthread_init(&e[i]->th, 0);
+		e[i]->th.cpu_invoke = cpu_invoke;
+		e[i]->th.pooled = true;
+		hpthread_setargs(&e[i]->th, &e[i]->args);
+		snprintf(e[i]->th.name, sizeof(e[i]->th.name), "pool.%s.%d", hpthread_get_prim_name(prim),
+			__atomic_fetch_add(&pool_count, 1, __ATOMIC_RELAXED));
+		hpthread_setprimitive(&e[i]->th, prim);
+		hpthread_setpriority(&e[i]->th, nprio);
+		th[i] = &e[i]->th;
+	}
+	hpthread_create_n(th, n);
+	// Those that VAM could only place on a CPU thread move to their blocking queue
+	hpthread_args_t **park = (hpthread_args_t **) malloc(n * sizeof(hpthread_args_t *));
+	unsigned n_cpu = 0;
+	for (unsigned i = 0; i < n; i++) {
+		if (!cpu_invoke && e[i]->th.accel->prim == PRIM_NONE) {
+			e[i]->park.queue_ptr = i * POOL_PARK_WORDS;
+			th[n_cpu] = &e[i]->th;
+			park[n_cpu++] = &e[i]->park;
+		}
+	}
+	hpthread_rebind_n(th, park, n_cpu);
+	free(park);
+	LOW_DEBUG(printf("[HPTHREAD] Parked %d hpthreads for %s in the warm pool.\n", n, hpthread_get_prim_name(prim));)
+
+	pthread_mutex_lock(&pool_lock);
+	for (unsigned i = 0; i < n; i++) {
+		e[i]->next = pool_list;
+		pool_list = e[i];
+	}
+	pthread_mutex_unlock(&pool_lock);
+	free(th);
+	free(e);
+}
+
+hpthread_t *hpthread_pool_get(hpthread_prim_t prim, bool cpu_invoke, hpthread_args_t *args) {
+	hpthread_t *th;
+	return hpthread_pool_get_n(prim, cpu_invoke, &args, &th, 1) ? th : NULL;
+}
+
+unsigned hpthread_pool_get_n(hpthread_prim_t prim, bool cpu_invoke, hpthread_args_t **args, hpthread_t **th, unsigned n) {
+	unsigned taken = 0;
+	pthread_mutex_lock(&pool_lock);
+	hpthread_pool_entry_t **p = &pool_list;
+	while (*p && taken < n) {
+		if ((*p)->th.prim != prim || (*p)->th.cpu_invoke != cpu_invoke) {
+			p = &((*p)->next);
+			continue;
+		}
+		th[taken++] = &(*p)->th;
+		*p = (*p)->next;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	// All of them switch with a single VAM request
+	hpthread_rebind_n(th, args, taken);
+	return taken;
+}
+
+void hpthread_pool_put(hpthread_t *th) {
+	hpthread_pool_put_n(&th, 1);
+}
+
+void hpthread_pool_put_n(hpthread_t **th, unsigned n) {
+	if (n == 0) return;
+	hpthread_args_t **park = (hpthread_args_t **) malloc(n * sizeof(hpthread_args_t *));
+	for (unsigned i = 0; i < n; i++) {
+		park[i] = &((hpthread_pool_entry_t *) th[i])->park;
+	}
+	hpthread_rebind_n(th, park, n);
+	free(park);
+	pthread_mutex_lock(&pool_lock);
+	for (unsigned i = 0; i < n; i++) {
+		hpthread_pool_entry_t *e = (hpthread_pool_entry_t *) th[i];
+		e->next = pool_list;
+		pool_list = e;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void hpthread_pool_drain() {
+	pthread_mutex_lock(&pool_lock);
+	hpthread_pool_entry_t *list = pool_list;
+	pool_list = NULL;
+	pthread_mutex_unlock(&pool_lock);
+
+	unsigned n = 0;
+	for (hpthread_pool_entry_t *e = list; e; e = e->next) n++;
+	hpthread_t **th = (hpthread_t **) malloc((n + 1) * sizeof(hpthread_t *));
+	n = 0;
+	for (hpthread_pool_entry_t *e = list; e; e = e->next) th[n++] = &e->th;
+	hpthread_join_n(th, n);
+	free(th);
+	while (list) {
+		hpthread_pool_entry_t *next = list->next;
+		// Entries still taken out keep the park queues of their batch alive
+		hpthread_pool_batch_t *batch = list->batch;
+		if (__atomic_sub_fetch(&(batch->live), 1, __ATOMIC_ACQ_REL) == 0) {
+			esp_free(batch->mem);
+			free(batch);
+		}
+		free(list);
+		list = next;
+	}
+}
+
 void hpthread_setargs(hpthread_t *th, hpthread_args_t *a) {
+	a->bind_seq = 0;
+	a->bind_ack = UINT_MAX; // until the worker picks up the binding
 	th->args = a;
 }
 
@@ -79,14 +326,8 @@ void hpthread_setpriority(hpthread_t *th, unsigned p) {
 	// If the thread is active, you need to inform VAM so the hardware can be configured
 	if (th->is_active) {
 		HIGH_DEBUG(printf("[HPTHREAD] Requested change of priority to %d for hpthread %s.\n", p, th->name);)
-		// Check if the interface is IDLE. If yes, swap to BUSY. If not, block until it is
-		while (!hpthread_intf_swap(VAM_IDLE, VAM_BUSY)) SCHED_YIELD;
-		// Write the hpthread request to the interface
-		intf.th = th;
-		// Set the interface state to SETPRIO
-		hpthread_intf_set(VAM_SETPRIO);
-		// Block until the request is complete (interface state is DONE), then swap to IDLE
-		while (!hpthread_intf_swap(VAM_DONE, VAM_IDLE)) SCHED_YIELD;
+		hpthread_req_t req;
+		hpthread_request(&req, VAM_SETPRIO, &th, 1);
 		HIGH_DEBUG(printf("[HPTHREAD] Change of priority to %d complete for hpthread %s.\n", p, th->name);)
 	}
 }
@@ -98,32 +339,31 @@ void hpthread_setaffinity(hpthread_t *th, unsigned accel_id) {
 hpthread_cand_t *hpthread_query() {
 	HIGH_DEBUG(printf("[HPTHREAD] Requested hpthread candidate list.\n");)
 
-    // If VAM has not yet been started (i.e., interface is in vam_state_t::RESET, start one thread now)
-    if (hpthread_intf_swap(VAM_RESET, VAM_WAKEUP)) {
-		// Only one thread should enter here; remaining will wait for idle state
-		wakeup_vam();
-		hpthread_intf_set(VAM_IDLE);
-    }
+	hpthread_start_vam();
 
-	// Check if the interface is IDLE. If yes, swap to BUSY. If not, block until it is
-	while (!hpthread_intf_swap(VAM_IDLE, VAM_BUSY)) SCHED_YIELD;
-	// Set the interface state to QUERY
-    hpthread_intf_set(VAM_QUERY);
-	// Block until the request is complete (interface state is DONE), then swap to IDLE
-	while (!hpthread_intf_swap(VAM_DONE, VAM_IDLE)) SCHED_YIELD;
+	hpthread_req_t req;
+	hpthread_request(&req, VAM_QUERY, NULL, 0);
 	HIGH_DEBUG(printf("[HPTHREAD] Received hpthread candidate list.\n");)
-	// Return the empty hpthread candidate list to the caller
-	return intf.list;
+	// Return the hpthread candidate list to the caller
+	return req.list;
+}
+
+unsigned hpthread_snapshot(hpthread_snap_t *snap, unsigned max, uint32_t *version) {
+	hpthread_start_vam();
+
+	// VAM publishes the first table once it has probed the accelerators
+	uint32_t v;
+	unsigned n;
+	while ((n = hpthread_intf_snapshot(snap, max, &v)) == 0 && v == 0) SCHED_YIELD;
+	HIGH_DEBUG(printf("[HPTHREAD] Read snapshot version %d of %d accelerators.\n", v, n);)
+	if (version) *version = v;
+	return n;
 }
 
 void hpthread_report() {
 	HIGH_DEBUG(printf("[HPTHREAD] Requested report from VAM.\n");)
-	// Check if the interface is IDLE. If yes, swap to BUSY. If not, block until it is
-	while (!hpthread_intf_swap(VAM_IDLE, VAM_BUSY)) SCHED_YIELD;
-	// Set the interface state to QUERY
-    hpthread_intf_set(VAM_REPORT);
-	// Block until the request is complete (interface state is DONE), then swap to IDLE
-	while (!hpthread_intf_swap(VAM_DONE, VAM_IDLE)) SCHED_YIELD;
+	hpthread_req_t req;
+	hpthread_request(&req, VAM_REPORT, NULL, 0);
 	HIGH_DEBUG(printf("[HPTHREAD] Report complete.\n");)	
 }
 
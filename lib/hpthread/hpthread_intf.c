@@ -1,4 +1,10 @@
 #include <hpthread_intf.h>
+#include <sched.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 // Global instance of hpthread interface
 hpthread_intf_t intf;
@@ -17,3 +23,128 @@ uint8_t hpthread_intf_test() {
 void hpthread_intf_set(uint8_t set_value) {
     __atomic_store_n(&intf.state, set_value, __ATOMIC_SEQ_CST);
 }
+
+// Turn of the slot for a position: free at 2 * lap, full at 2 * lap + 1
+static inline uint64_t hpthread_intf_turn(uint64_t pos) {
+    return 2 * (pos / VAM_RING_SIZE);
+}
+
+static void hpthread_intf_futex_wait(uint32_t *word, uint32_t key, struct timespec *timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, key, timeout, NULL, 0);
+}
+
+static void hpthread_intf_futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void hpthread_intf_submit(hpthread_req_t *req) {
+    __atomic_store_n(&(req->done), 0, __ATOMIC_RELAXED);
+    // Reserve a slot; if the ring is full, wait for VAM to drain it
+    uint64_t pos = __atomic_load_n(&intf.head, __ATOMIC_RELAXED);
+    hpthread_intf_cell_t *cell;
+    while (1) {
+        cell = &intf.cells[pos & (VAM_RING_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+        uint64_t turn = hpthread_intf_turn(pos);
+        if (seq == turn) {
+            if (__atomic_compare_exchange_n(&intf.head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (seq < turn) {
+            SCHED_YIELD;
+            pos = __atomic_load_n(&intf.head, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&intf.head, __ATOMIC_RELAXED);
+        }
+    }
+    cell->req = req;
+    __atomic_store_n(&(cell->seq), hpthread_intf_turn(pos) + 1, __ATOMIC_RELEASE);
+
+    // Ring the doorbell only if VAM is (about to be) asleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&intf.sleeping, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&intf.doorbell, 1, __ATOMIC_SEQ_CST);
+        hpthread_intf_futex_wake(&intf.doorbell);
+    }
+}
+
+void hpthread_intf_wait(hpthread_req_t *req) {
+    while (!__atomic_load_n(&(req->done), __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&intf.waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t key = __atomic_load_n(&intf.completed, __ATOMIC_SEQ_CST);
+        // Recheck after announcing the wait, so a completion in between is not missed
+        if (!__atomic_load_n(&(req->done), __ATOMIC_SEQ_CST)) {
+            hpthread_intf_futex_wait(&intf.completed, key, NULL);
+        }
+        __atomic_fetch_sub(&intf.waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+hpthread_req_t *hpthread_intf_next() {
+    // Only VAM drains the ring, so the tail needs no CAS
+    uint64_t pos = intf.tail;
+    hpthread_intf_cell_t *cell = &intf.cells[pos & (VAM_RING_SIZE - 1)];
+    if (__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) != hpthread_intf_turn(pos) + 1) return NULL;
+    hpthread_req_t *req = cell->req;
+    __atomic_store_n(&(cell->seq), hpthread_intf_turn(pos) + 2, __ATOMIC_RELEASE);
+    intf.tail = pos + 1;
+    return req;
+}
+
+void hpthread_intf_complete(hpthread_req_t *req) {
+    // The caller may free req once done is set, so wake it through the interface's word
+    __atomic_store_n(&(req->done), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&intf.waiters, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&intf.completed, 1, __ATOMIC_SEQ_CST);
+        hpthread_intf_futex_wake(&intf.completed);
+    }
+}
+
+void hpthread_intf_sleep(uint64_t timeout_ns) {
+    uint32_t key = __atomic_load_n(&intf.doorbell, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&intf.sleeping, 1, __ATOMIC_SEQ_CST);
+    // Recheck after announcing the sleep, so a request queued in between is not missed
+    hpthread_intf_cell_t *cell = &intf.cells[intf.tail & (VAM_RING_SIZE - 1)];
+    if (__atomic_load_n(&(cell->seq), __ATOMIC_SEQ_CST) != hpthread_intf_turn(intf.tail) + 1) {
+        struct timespec timeout = { timeout_ns / 1000000000, timeout_ns % 1000000000 };
+        hpthread_intf_futex_wait(&intf.doorbell, key, &timeout);
+    }
+    __atomic_store_n(&intf.sleeping, 0, __ATOMIC_RELAXED);
+}
+
+void hpthread_intf_publish(hpthread_snap_t *snap, unsigned n) {
+    if (n > VAM_SNAP_MAX) n = VAM_SNAP_MAX;
+    uint32_t words[VAM_SNAP_WORDS];
+    unsigned n_words = n * sizeof(hpthread_snap_t) / sizeof(uint32_t);
+    memcpy(words, snap, n * sizeof(hpthread_snap_t));
+    // Only VAM writes the table; make it odd before touching the entries
+    uint32_t seq = intf.snap.seq;
+    __atomic_store_n(&intf.snap.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&intf.snap.n, n, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < n_words; i++) {
+        __atomic_store_n(&intf.snap.words[i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&intf.snap.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+unsigned hpthread_intf_snapshot(hpthread_snap_t *snap, unsigned max, uint32_t *version) {
+    uint32_t words[VAM_SNAP_WORDS];
+    uint32_t seq, n;
+    while (1) {
+        seq = __atomic_load_n(&intf.snap.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            SCHED_YIELD;
+            continue;
+        }
+        n = __atomic_load_n(&intf.snap.n, __ATOMIC_RELAXED);
+        unsigned n_words = ((n < max) ? n : max) * sizeof(hpthread_snap_t) / sizeof(uint32_t);
+        for (unsigned i = 0; i < n_words; i++) {
+            words[i] = __atomic_load_n(&intf.snap.words[i], __ATOMIC_RELAXED);
+        }
+        // Retry if VAM published a new table while we were copying
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&intf.snap.seq, __ATOMIC_RELAXED) == seq) break;
+    }
+    memcpy(snap, words, ((n < max) ? n : max) * sizeof(hpthread_snap_t));
+    if (version) *version = seq / 2;
+    return n;
+}
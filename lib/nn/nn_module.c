@@ -1,7 +1,10 @@
 #include <stdlib.h>
 #include <nn_module.h>
 #include <gemm_node_args.h>
+#include <sw_gemm.h>
+#include <nn_weights.h>
 #include <string.h>
+#include <math.h>
 #include <libesp.h>
 #ifndef ENABLE_VAM
 #include <dirent.h>
@@ -10,10 +13,225 @@
 #include <gemm_def.h>
 #endif
 
-#if !defined(ENABLE_SM) || defined(ENABLE_MOZART)
-static unsigned th_affinity_ctr = 1;
+#if defined(ENABLE_VAM) && (!defined(ENABLE_SM) || defined(ENABLE_MOZART))
+// Pick an accelerator for the next hpthread of a model from the VAM snapshot: the least loaded
+// GEMM accelerator with a free context, preferring emptier ones at similar load, as VAM does.
+// The pick is charged to the caller's copy so that the threads of a model spread out.
+// Returns the affinity (accel_id + 1), or 0 to leave the choice to VAM.
+static unsigned nn_module_pick_accel(nn_module *m, hpthread_snap_t *snap, unsigned n) {
+    hpthread_snap_t *best = NULL;
+    float best_load = 0.0;
+    for (unsigned i = 0; i < n; i++) {
+        hpthread_snap_t *e = &snap[i];
+        if (e->prim != PRIM_GEMM || e->cpu_invoke != m->cpu_invoke || e->free_contexts == 0) continue;
+        // Utilization, plus the average fill of the input queues of its contexts
+        float load = e->effective_util + e->queue_pressure / MAX_CONTEXTS;
+        if (!best || load < best_load - 0.1 ||
+            (fabsf(load - best_load) <= 0.1 && e->free_contexts > best->free_contexts)) {
+            best = e;
+            best_load = load;
+        }
+    }
+    if (!best) return 0;
+    best->free_contexts--;
+    best->effective_util += 1.0 / m->nprio;
+    return best->accel_id + 1;
+}
 #endif
 
+// Memory pools of the loaded modules; also guards their weight caches
+static nn_mem_pool *nn_pool_list = NULL;
+static pthread_mutex_t nn_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Attach a module to the newest pool of its model file if another registered tenant fits in it,
+// or to a new pool otherwise
+static void nn_mem_pool_attach(nn_module *m, const char *model_file) {
+    char path[256] = "";
+    if (m->share_weights && !realpath(model_file, path)) snprintf(path, sizeof(path), "%s", model_file);
+    pthread_mutex_lock(&nn_pool_lock);
+    nn_mem_pool *p = NULL;
+    if (path[0] != '\0') {
+        for (nn_mem_pool *cur = nn_pool_list; cur; cur = cur->next) {
+            if (strcmp(cur->path, path)) continue;
+            // Only join once a tenant has registered, so its footprint is known
+            if (cur->tenant_words && __atomic_load_n(&cur->allocated, __ATOMIC_RELAXED) + cur->tenant_words <= cur->size) p = cur;
+            break;
+        }
+    }
+    if (!p) {
+        p = (nn_mem_pool *) malloc(sizeof(nn_mem_pool));
+        snprintf(p->path, sizeof(p->path), "%s", path);
+        p->mem = esp_alloc(NN_MODULE_MEM_SIZE);
+        p->size = NN_MODULE_MEM_SIZE / sizeof(unsigned);
+        p->allocated = 0;
+        p->refs = 0;
+        p->tenant_words = 0;
+        p->weights = NULL;
+        p->next = nn_pool_list;
+        nn_pool_list = p;
+    } else {
+        LOW_DEBUG(printf("[NN%d] Sharing module memory with %d other module(s) of %s\n", m->id, p->refs, path);)
+    }
+    p->refs++;
+    pthread_mutex_unlock(&nn_pool_lock);
+    m->pool = p;
+    m->mem = p->mem;
+}
+
+static void nn_mem_pool_detach(nn_mem_pool *p) {
+    pthread_mutex_lock(&nn_pool_lock);
+    if (--p->refs == 0) {
+        for (nn_mem_pool **cur = &nn_pool_list; *cur; cur = &(*cur)->next) {
+            if (*cur == p) {
+                *cur = p->next;
+                break;
+            }
+        }
+        while (p->weights) {
+            nn_weight_entry *next = p->weights->next;
+            free(p->weights);
+            p->weights = next;
+        }
+        esp_free(p->mem);
+        free(p);
+    }
+    pthread_mutex_unlock(&nn_pool_lock);
+}
+
+// Find the cached copy of a weight block in the pool, or add an entry for it (*hit = false)
+// that the caller allocates, initializes and then marks ready; called with nn_pool_lock held
+static nn_weight_entry *nn_mem_pool_weights(nn_mem_pool *p, const char *path, uint64_t key, unsigned len, unsigned prec, bool packed, bool *hit) {
+    for (nn_weight_entry *e = p->weights; e; e = e->next) {
+        if (e->key == key && e->len == len && e->prec == prec && e->packed == packed && !strcmp(e->path, path)) {
+            *hit = true;
+            return e;
+        }
+    }
+    nn_weight_entry *e = (nn_weight_entry *) malloc(sizeof(nn_weight_entry));
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->key = key;
+    e->ready = false;
+    e->len = len;
+    e->prec = prec;
+    e->packed = packed;
+    e->weight_base = e->packed_base = 0;
+    e->q_scale = NN_SCALE;
+    e->q_zero = 0;
+    e->next = p->weights;
+    p->weights = e;
+    *hit = false;
+    return e;
+}
+
+// Look up a weight block; on a hit, wait until the module loading it is done
+static nn_weight_entry *nn_mem_pool_get_weights(nn_mem_pool *p, const char *path, uint64_t key, unsigned len, unsigned prec, bool packed, bool *hit) {
+    pthread_mutex_lock(&nn_pool_lock);
+    nn_weight_entry *e = nn_mem_pool_weights(p, path, key, len, prec, packed, hit);
+    pthread_mutex_unlock(&nn_pool_lock);
+    if (*hit) {
+        while (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE)) SCHED_YIELD;
+    }
+    return e;
+}
+
+// Point a GEMM layer at its weights, bias and packed weights, loading them into the pool
+// unless another module of the same model already did
+static void nn_module_load_weights(nn_module *m, nn_node_t *node, gemm_node_args *gemm_args) {
+    gemm_params_t *params = &(gemm_args->params);
+    unsigned len = params->dim_n * params->dim_k;
+    // a single weight column is already contiguous for the GEMV kernel
+    bool packed = m->pack_weights && params->dim_n > 1 && params->prec == GEMM_PREC_Q32;
+    bool synthetic = (gemm_args->input_file[0] == '\n');
+    bool hit;
+
+    // Files are keyed by path and version, synthetic weights by their seed (the node ID).
+    // Only the lookup holds the pool lock; a miss is loaded outside it and then published.
+    uint64_t key = synthetic ? (uint64_t) node->id : nn_weights_file_key(gemm_args->input_file);
+    nn_weight_entry *e = nn_mem_pool_get_weights(m->pool, synthetic ? "" : gemm_args->input_file, key, len, params->prec, packed, &hit);
+    if (!hit) {
+        // Weights at the layer's storage precision; quantized layers are staged at 16.16 and converted
+        e->weight_base = nn_mem_pool_malloc(m->pool, gemm_quant_size(params->prec, len));
+        nn_token_t *wgt_address = (nn_token_t *) (m->mem) + e->weight_base;
+        nn_token_t *staging = (params->prec == GEMM_PREC_Q32) ? wgt_address : (nn_token_t *) malloc(len * sizeof(nn_token_t));
+        if (synthetic) {
+            initialize_random(staging, len, (unsigned) key);
+        } else {
+            initialize_data(gemm_args->input_file, staging, len);
+        }
+        if (params->prec != GEMM_PREC_Q32) {
+            gemm_quantize_b(staging, wgt_address, params->prec, len, &e->q_scale, &e->q_zero);
+            free(staging);
+            HIGH_DEBUG(printf("[NN%d] Quantized weights of %s: scale=%d zero=%d\n", m->id, nn_node_get_name(node), e->q_scale, e->q_zero);)
+        }
+        // Panel-packed copy of the weights for the CPU kernels
+        if (packed) {
+            e->packed_base = nn_mem_pool_malloc(m->pool, gemm_packed_size(params->dim_n, params->dim_k));
+            gemm_pack_b(wgt_address, (nn_token_t *) (m->mem) + e->packed_base, params->dim_n, params->dim_k);
+        }
+        __atomic_store_n(&e->ready, true, __ATOMIC_RELEASE);
+    } else {
+        HIGH_DEBUG(printf("[NN%d] Reusing cached weights for %s at %d\n", m->id, nn_node_get_name(node), e->weight_base);)
+    }
+    params->weight_base = e->weight_base;
+    params->q_scale = e->q_scale;
+    params->q_zero = e->q_zero;
+    if (packed) {
+        params->packed_base = e->packed_base;
+        params->flags |= GEMM_FLAG_PACKED;
+    }
+
+    // Bias vector for the fused epilogue
+    if (gemm_args->bias_file[0] != '\0') {
+        e = nn_mem_pool_get_weights(m->pool, gemm_args->bias_file, nn_weights_file_key(gemm_args->bias_file), params->dim_n, GEMM_PREC_Q32, false, &hit);
+        if (!hit) {
+            e->weight_base = nn_mem_pool_malloc(m->pool, params->dim_n);
+            initialize_data(gemm_args->bias_file, (nn_token_t *) (m->mem) + e->weight_base, params->dim_n);
+            __atomic_store_n(&e->ready, true, __ATOMIC_RELEASE);
+        }
+        params->bias_base = e->weight_base;
+        params->flags |= GEMM_FLAG_BIAS;
+    }
+}
+
+// Allocate and initialize one of the module's queues in the given layout (0 for the plain one)
+static unsigned nn_module_alloc_queue(nn_module *m, uint64_t layout) {
+    unsigned offset;
+    if (layout) {
+        // Round up to a cache line so the producer and consumer lines are not shared
+        unsigned words = (layout == SM_QUEUE_MPMC) ? SM_QUEUE_MPMC_WORDS(m->queue_depth) : SM_QUEUE_SPSC_WORDS(m->queue_depth);
+        unsigned stats_words = 0;
+        #ifdef DO_QUEUE_STATS
+        stats_words = SM_QUEUE_STATS_WORDS(m->queue_depth) + SM_QUEUE_LINE_WORDS - 1; // on the lines after the queue
+        #endif
+        offset = nn_module_malloc(m, words + stats_words + SM_QUEUE_LINE_WORDS - 1);
+        offset = (offset + SM_QUEUE_LINE_WORDS - 1) / SM_QUEUE_LINE_WORDS * SM_QUEUE_LINE_WORDS;
+        sm_queue_t *q = (sm_queue_t *) ((unsigned *) (m->mem) + offset);
+        if (layout == SM_QUEUE_MPMC) sm_queue_init_mpmc(q, m->queue_depth);
+        else sm_queue_init_spsc(q, m->queue_depth);
+        if (m->block_waits) sm_queue_set_blocking(q);
+        #ifdef DO_QUEUE_STATS
+        unsigned stats_offset = (offset + words + SM_QUEUE_LINE_WORDS - 1) / SM_QUEUE_LINE_WORDS * SM_QUEUE_LINE_WORDS;
+        sm_queue_attach_stats(q, (sm_queue_stats_t *) ((unsigned *) (m->mem) + stats_offset));
+        #endif
+    } else {
+        offset = nn_module_malloc(m, SM_COMMON_SIZE + (SM_QUEUE_SIZE * 2)); // uint64_t entries
+        sm_queue_init((sm_queue_t *) ((unsigned *) (m->mem) + offset));
+    }
+    return offset;
+}
+
+// Input and output queues take the MPMC layout when several clients share the module, unless
+// an accelerator reads them; clients then serialize on the module's locks instead
+static uint64_t nn_module_client_layout(nn_module *m, uint64_t single) {
+    return (m->multi_client && m->cpu_invoke) ? SM_QUEUE_MPMC : single;
+}
+
+static inline bool nn_module_lock(nn_module *m, sm_queue_t *q, pthread_mutex_t *lock) {
+    if (!m->multi_client || sm_queue_is_mpmc(q)) return false;
+    pthread_mutex_lock(lock);
+    return true;
+}
+
 // Load a model using a description in a txt model_def
 void nn_module_load(nn_module *m, const char *n) {
     // Check if the model description file exists
@@ -26,14 +244,19 @@ void nn_module_load(nn_module *m, const char *n) {
     // Create an NN computational graph and memory for this model
     m->graph = (nn_graph_t *) malloc (sizeof(nn_graph_t));
     nn_graph_create(m->graph);
-    const unsigned mem_size = 8 * 1024 * 1024; // 8MB
-    m->mem = esp_alloc(mem_size);
     m->mem_allocated = 0;
     m->req_cnt = 0;
     m->th_list = NULL;
     m->descr_list = NULL;
     m->loop_around = 1;
-    m->pending_requeues = 0;
+    m->queue_depth = SM_QUEUE_SIZE;
+    m->slots_reserved = 0;
+    m->pack_weights = false;
+    m->share_weights = true;
+    m->multi_client = false;
+    m->block_waits = false;
+    pthread_mutex_init(&m->req_lock, NULL);
+    pthread_mutex_init(&m->rsp_lock, NULL);
     #ifndef ENABLE_VAM
     m->accel_list = NULL;
     m->active_cycles = 0;
@@ -73,11 +296,64 @@ void nn_module_load(nn_module *m, const char *n) {
                         // Read the parameters of the GEMM from the following chars
                         gemm_node_args *args = (gemm_node_args *) malloc (sizeof(gemm_node_args));
                         gemm_params_t *params= &(args->params);
-                        if (sscanf(in_line_buf + ofs, "%d %d %d %s", &params->dim_m, &params->dim_n, &params->dim_k, args->input_file) == 3) {
-                            // If no input file was provided, the pointer is marked invalid.
-                            HIGH_DEBUG(printf("[NN%d] No input file provided for GEMM node %d, using random data.\n", m->id, node_id);)
-                            args->input_file[0] = '\n'; args->input_file[1] = '\0';
-                        } 
+                        params->flags = 0;
+                        params->packed_base = 0;
+                        params->bias_base = 0;
+                        params->act = GEMM_ACT_NONE;
+                        params->act_lo = params->act_hi = 0;
+                        params->prec = GEMM_PREC_Q32;
+                        params->q_scale = NN_SCALE;
+                        params->q_zero = 0;
+                        args->bias_file[0] = '\0';
+                        // Dimensions, then an optional weight file and optional key=value attributes:
+                        // -- bias=<file>, act=relu, act=clamp:<lo>:<hi>, act=sat, prec=q32|q16|q8
+                        // -- bias=, act= and prec=q16|q8 need a CPU-invoked module when VAM places it on accelerators
+                        int dim_ofs = 0;
+                        sscanf(in_line_buf + ofs, "%d %d %d %n", &params->dim_m, &params->dim_n, &params->dim_k, &dim_ofs);
+                        // Resolve the tuned tiling once per layer, not on every GEMM call
+                        params->tune = gemm_tune_slot(params->dim_m, params->dim_n, params->dim_k);
+                        // If no input file was provided, the pointer is marked invalid.
+                        args->input_file[0] = '\n'; args->input_file[1] = '\0';
+                        char *save = NULL;
+                        for (char *tok = strtok_r(in_line_buf + ofs + dim_ofs, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+                            float lo, hi;
+                            if (!strncmp(tok, "bias=", 5)) {
+                                snprintf(args->bias_file, sizeof(args->bias_file), "%s", tok + 5);
+                            } else if (!strcmp(tok, "act=relu")) {
+                                params->act = GEMM_ACT_RELU;
+                            } else if (!strcmp(tok, "act=sat")) {
+                                params->act = GEMM_ACT_SAT;
+                            } else if (!strcmp(tok, "prec=q32")) {
+                                params->prec = GEMM_PREC_Q32;
+                            } else if (!strcmp(tok, "prec=q16")) {
+                                params->prec = GEMM_PREC_Q16;
+                            } else if (!strcmp(tok, "prec=q8")) {
+                                params->prec = GEMM_PREC_Q8;
+                            } else if (sscanf(tok, "act=clamp:%f:%f", &lo, &hi) == 2) {
+                                params->act = GEMM_ACT_CLAMP;
+                                params->act_lo = nn_token_from_float(lo).value;
+                                params->act_hi = nn_token_from_float(hi).value;
+                            } else if (strchr(tok, '=')) {
+                                printf("[NN%d] Unknown attribute %s for GEMM node %d\n", m->id, tok, node_id);
+                            } else {
+                                snprintf(args->input_file, sizeof(args->input_file), "%s", tok);
+                            }
+                        }
+                        // An accelerator that polls the queues reads only the plain task parameters,
+                        // so it would skip the bias and activation pass
+                        if (nn_module_accel_polls(m) && (args->bias_file[0] != '\0' || params->act != GEMM_ACT_NONE)) {
+                            printf("[NN%d] GEMM node %d: bias= and act= need a CPU-invoked module\n", m->id, node_id);
+                            exit(1);
+                        }
+                        // ... and would read quantized weights as 16.16 tokens
+                        if (nn_module_accel_polls(m) && params->prec != GEMM_PREC_Q32) {
+                            printf("[NN%d] GEMM node %d: prec=q16|q8 needs a CPU-invoked module\n", m->id, node_id);
+                            exit(1);
+                        }
+                        HIGH_DEBUG(
+                            if (args->input_file[0] == '\n')
+                                printf("[NN%d] No input file provided for GEMM node %d, using random data.\n", m->id, node_id);
+                        )
                         gemm_node->args = (void *) args;
                         // Add the created node to the graph for the module
                         nn_graph_add_nn_node(m->graph, gemm_node);
@@ -119,6 +395,33 @@ void nn_module_load(nn_module *m, const char *n) {
                 break;
             }
             break;
+            case 'O': { // Module option
+                char key[32];
+                int value;
+                if (sscanf(in_line_buf, "O %31s %d", key, &value) != 2) {
+                    printf("[NN%d] Malformed option line: %s\n", m->id, in_line_buf);
+                    break;
+                }
+                if (!strcmp(key, "pack")) {
+                    m->pack_weights = (value != 0);
+                } else if (!strcmp(key, "share")) {
+                    m->share_weights = (value != 0);
+                } else if (!strcmp(key, "block")) {
+                    m->block_waits = (value != 0);
+                } else if (!strcmp(key, "clients")) {
+                    m->multi_client = (value > 1);
+                } else if (!strcmp(key, "depth")) {
+                    if (sm_queue_valid_capacity(value)) {
+                        m->queue_depth = value;
+                    } else {
+                        printf("[NN%d] Queue depth %d is not a power of two up to %d, keeping %d\n", m->id, value, SM_QUEUE_MAX, m->queue_depth);
+                    }
+                } else {
+                    printf("[NN%d] Unknown option %s\n", m->id, key);
+                }
+                HIGH_DEBUG(printf("[NN%d] Option %s = %d\n", m->id, key, value);)
+                break;
+            }
             case '#': // Comment
                 break;
             default:
@@ -126,9 +429,53 @@ void nn_module_load(nn_module *m, const char *n) {
                 break;
         }
     }
+    fclose(model_def);
     HIGH_DEBUG(nn_graph_dump(m->graph);)
+
+    // Plain queues (polled by accelerators, or shared by limited-thread stages) have a fixed capacity
+    if (m->queue_depth != SM_QUEUE_SIZE && (!m->cpu_invoke || m->n_threads > 0)) {
+        printf("[NN%d] Queue depth %d needs a CPU-invoked module without n_threads, keeping %d\n", m->id, m->queue_depth, SM_QUEUE_SIZE);
+        m->queue_depth = SM_QUEUE_SIZE;
+    }
+    if (m->queue_depth < SM_QUEUE_MPMC_MIN && nn_module_client_layout(m, 0) == SM_QUEUE_MPMC) {
+        printf("[NN%d] Queue depth %d is too small for several clients, using %d\n", m->id, m->queue_depth, SM_QUEUE_MPMC_MIN);
+        m->queue_depth = SM_QUEUE_MPMC_MIN;
+    }
+    // Plain queues have no room for the wait events, so waits on them always spin
+    if (m->block_waits && (!m->cpu_invoke || m->n_threads > 0)) {
+        printf("[NN%d] Blocking waits need a CPU-invoked module without n_threads, ignoring O block\n", m->id);
+        m->block_waits = false;
+    }
+
+    // Memory is attached once the options are known
+    nn_mem_pool_attach(m, n);
 }
 
+#ifdef ENABLE_VAM
+// Replace the new hpthreads of a module with warm ones from the pool, bound to the same args
+// with a single VAM request; the hpthreads they replace are never created
+static void nn_module_use_pool(nn_module *m) {
+    unsigned n;
+    hpthread_t **th = nn_module_hpthread_array(m, false, &n);
+    hpthread_args_t **args = (hpthread_args_t **) malloc(sizeof(hpthread_args_t *) * (n + 1));
+    for (unsigned i = 0; i < n; i++) args[i] = th[i]->args;
+    hpthread_t **warm = (hpthread_t **) malloc(sizeof(hpthread_t *) * (n + 1));
+    unsigned n_warm = hpthread_pool_get_n(PRIM_GEMM, m->cpu_invoke, args, warm, n);
+    unsigned i = 0;
+    for (nn_hpthread_list *cur = m->th_list; cur && i < n_warm; cur = cur->next) {
+        if (cur->th->pooled) continue;
+        HIGH_DEBUG(printf("[NN%d] Using pooled hpthread %s for %s\n", m->id, hpthread_get_name(warm[i]), hpthread_get_name(cur->th)););
+        free(cur->th->args);
+        free(cur->th);
+        cur->th = warm[i++];
+        if (cur->th->nprio != m->nprio) hpthread_setpriority(cur->th, m->nprio);
+    }
+    free(warm);
+    free(args);
+    free(th);
+}
+#endif
+
 // Register the model with NN frontend
 void nn_module_register(nn_module *m) {
     // We will maintain a queue of nodes to-be-visited in BFS order and a list of visited nodes
@@ -140,6 +487,8 @@ void nn_module_register(nn_module *m) {
     // Add entry to queue and set
     nn_queue_push(q, entry);
     nn_set_add_node(&visited, entry);
+    // GEMM layers in visiting order, for loading their weights
+    nn_queue_t layers = { NULL, NULL };
     LOW_DEBUG(printf("[NN%d] Parsing NN graph for %s\n", m->id, nn_module_get_name(m)));
     // Allocate queues for each if the user specified a number
     unsigned *queue_list = NULL;
@@ -147,13 +496,19 @@ void nn_module_register(nn_module *m) {
     unsigned queue_count = 0;
     unsigned layer_count = 0;
     unsigned thread_count = 0;
+    #if defined(ENABLE_VAM) && (!defined(ENABLE_SM) || defined(ENABLE_MOZART))
+    // Accelerator load as last published by VAM, for placing the hpthreads of this model
+    hpthread_snap_t snap[HPTHREAD_SNAP_MAX];
+    unsigned n_snap = hpthread_snapshot(snap, HPTHREAD_SNAP_MAX, NULL);
+    if (n_snap > HPTHREAD_SNAP_MAX) n_snap = HPTHREAD_SNAP_MAX;
+    #endif
     if (m->n_threads > 0) {
         queue_list = (unsigned *) malloc (sizeof(unsigned) * (m->n_threads + 1)); // one for each thread + one for exit
         for (unsigned i = 0; i < m->n_threads + 1; i++) {
             // Allocate input queue
-            queue_list[i] = nn_module_malloc(m, SM_COMMON_SIZE + (SM_QUEUE_SIZE * 2)); // uint64_t entries
-            sm_queue_t *q = (sm_queue_t *) ((unsigned *) (m->mem) + queue_list[i]);
-            sm_queue_init(q);
+            // Stages share these queues, so they keep the plain layout; only the clients
+            // push to the first one and pop from the last one
+            queue_list[i] = nn_module_alloc_queue(m, (i == 0 || i == m->n_threads) ? nn_module_client_layout(m, 0) : 0);
             HIGH_DEBUG(printf("[NN%d] Queue %d offset = %d\n", m->id, i, queue_list[i]);)
         }
         limit_threads = true;
@@ -176,18 +531,18 @@ void nn_module_register(nn_module *m) {
 
                 // Allocate memory for the edge and store the offset in the args (for QUEUE_SIZE)
                 nn_edge_args *edge_args = out->args;
-                edge_args->data_offset = nn_module_malloc(m, SM_QUEUE_SIZE * edge_args->len);
+                edge_args->data_offset = nn_module_malloc(m, m->queue_depth * edge_args->len);
                 HIGH_DEBUG(printf("[NN%d] Data offset for edge to %s = %d\n", m->id, nn_node_get_name(dst), edge_args->data_offset);)
                 // TODO assumes all destination tasks are GEMM and have same task parameters
                 // Allocate descriptor pointers + descriptors
-                edge_args->descr_offset = nn_module_malloc(m, GEMM_TASK_DESCR_WORDS + (SM_QUEUE_SIZE * GEMM_ENTRY_SIZE));
+                edge_args->descr_offset = nn_module_malloc(m, GEMM_TASK_DESCR_WORDS(m->queue_depth) + (m->queue_depth * GEMM_ENTRY_SIZE));
                 gemm_task_descr *descr = (gemm_task_descr *) ((unsigned *) (m->mem) + edge_args->descr_offset);
                 descr->common.prim = PRIM_GEMM;
                 // Descriptors are arranged contiguously
                 HIGH_DEBUG(printf("[NN%d] Descr offset for edge to %s = %d\n", m->id, nn_node_get_name(dst), edge_args->descr_offset);)
                 HIGH_DEBUG(printf("[NN%d] Printing task descriptor for edge to %s...\n", m->id, nn_node_get_name(dst));)
-                for (int i = 0; i < SM_QUEUE_SIZE; i++) {
-                    descr->descr_offset[i] = edge_args->descr_offset + GEMM_TASK_DESCR_WORDS + (i * GEMM_ENTRY_SIZE);
+                for (unsigned i = 0; i < m->queue_depth; i++) {
+                    descr->descr_offset[i] = edge_args->descr_offset + GEMM_TASK_DESCR_WORDS(m->queue_depth) + (i * GEMM_ENTRY_SIZE);
                     HIGH_DEBUG(printf("\tdescr->descr_offset[%d] = %lu\n", i, descr->descr_offset[i]);)
                 }
                 if (limit_threads) {
@@ -197,10 +552,10 @@ void nn_module_register(nn_module *m) {
                     HIGH_DEBUG(printf("[NN%d] Assigned queue offset for edge to %s = %d\n", m->id, nn_node_get_name(dst), edge_args->queue_offset);)
                 } else {
                     // Allocate queue descriptors for the output edge
-                    edge_args->queue_offset = nn_module_malloc(m, SM_COMMON_SIZE + (SM_QUEUE_SIZE * 2)); // uint64_t entries
-                    // Init the queue
-                    sm_queue_t *q = (sm_queue_t *) ((unsigned *) (m->mem) + edge_args->queue_offset);
-                    sm_queue_init(q);
+                    // Queues of CPU-invoked modules are never read by an accelerator
+                    uint64_t layout = m->cpu_invoke ? SM_QUEUE_SPSC : 0;
+                    if (current->is_entry || dst->is_exit) layout = nn_module_client_layout(m, layout);
+                    edge_args->queue_offset = nn_module_alloc_queue(m, layout);
                     HIGH_DEBUG(printf("[NN%d] Queue offset for edge to %s = %d\n", m->id, nn_node_get_name(dst), edge_args->queue_offset);)
                 }
             }
@@ -212,30 +567,23 @@ void nn_module_register(nn_module *m) {
         if (nn_op != NN_OP_NONE) {
             switch(nn_op) {
                 case NN_OP_GEMM: {
-                    // Get node params for allocating weights (input/output done above)
-                    gemm_node_args *gemm_args = (gemm_node_args *) current->args;
-                    gemm_params_t *params = &(gemm_args->params);
-                    // Allocate memory for weights
-                    params->weight_base = nn_module_malloc(m, params->dim_n * params->dim_k); 
+                    // Weights and the task parameters that depend on them are filled in after the
+                    // hpthreads are requested, so VAM places them while the weights load
+                    nn_queue_push(&layers, current);
                     // Retrieve input and output offsets from its first edges; assumes single producer, single consumer
                     nn_edge_args *in_args = current->in_edges->e->args; nn_edge_args *out_args = current->out_edges->e->args;
                     // Get the descriptors of incoming edge
                     gemm_task_descr *descr = (gemm_task_descr *) ((unsigned *) (m->mem) + in_args->descr_offset);
-                    for (int i = 0; i < SM_QUEUE_SIZE; i++) {
+                    for (unsigned i = 0; i < m->queue_depth; i++) {
                         gemm_queue_entry_t *descr_entry = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr->descr_offset[i]);
                         sm_queue_entry_t *descr_common = &(descr_entry->common);
-                        gemm_params_t *descr_params = &(descr_entry->gemm_params);
-                        *descr_params = *params;
-                        descr_params->input_base = in_args->data_offset + i * (in_args->len);
-                        descr_params->output_base = out_args->data_offset + i * (out_args->len);
                         if (limit_threads) {
                             // Check if this is the desctiptor for the last thread
                             descr_common->output_queue = (layer_count % m->n_threads == m->n_threads - 1) ? queue_list[m->n_threads] : out_args->queue_offset;
                         } else {
                             descr_common->output_queue = out_args->queue_offset;
                         }
-                        descr_common->output_entry = out_args->descr_offset + GEMM_TASK_DESCR_WORDS + i * (GEMM_ENTRY_SIZE);
-                        HIGH_DEBUG(print_gemm_entry(descr_entry);)
+                        descr_common->output_entry = out_args->descr_offset + GEMM_TASK_DESCR_WORDS(m->queue_depth) + i * (GEMM_ENTRY_SIZE);
                     }
                     layer_count++;
 
@@ -259,15 +607,12 @@ void nn_module_register(nn_module *m) {
                         hpthread_setprimitive(th, PRIM_GEMM);
                         hpthread_setpriority(th, m->nprio);
                         #if !defined(ENABLE_SM) || defined(ENABLE_MOZART)
-                        hpthread_setaffinity(th, th_affinity_ctr++); // Assign to different accelerators with m->n_threads
+                        hpthread_setaffinity(th, nn_module_pick_accel(m, snap, n_snap)); // Spread over the least loaded accelerators
                         #else
                         // hpthread_setaffinity(th, (m->id * 1) + (thread_count % 1)); // All on same accelerator
                         #endif
                         HIGH_DEBUG(printf("[NN%d] queue ptr for %s = %d...\n", m->id, hpthread_name, h_args->queue_ptr););
-                        HIGH_DEBUG(printf("[NN%d] Before hpthread create for %s...\n", m->id, hpthread_name));
-                        // Create a hpthread
-                        hpthread_create(th);
-                        // Assign the thread to the model list
+                        // Assign the thread to the model list; they are created (or taken from the pool) below
                         nn_module_add_hpthread(m, th);
                         thread_count++;
                     }
@@ -288,9 +633,6 @@ void nn_module_register(nn_module *m) {
                     }
                     #endif
 
-                    // Initialize the weights if present
-                    nn_token_t *wgt_address = ((nn_token_t *) (m->mem) + params->weight_base);
-                    initialize_data(gemm_args->input_file, wgt_address, params->dim_n * params->dim_k);
                     nn_module_add_task_descr(m, (nn_task_descr *) descr);
                     break;
                 }
@@ -313,7 +655,7 @@ void nn_module_register(nn_module *m) {
     // Get the descriptors of incoming edge
     gemm_task_descr *descr = (gemm_task_descr *) ((unsigned *) (m->mem) + in_args->descr_offset);
     descr->common.prim = PRIM_NONE;
-    for (int i = 0; i < SM_QUEUE_SIZE; i++) {
+    for (unsigned i = 0; i < m->queue_depth; i++) {
         gemm_queue_entry_t *descr_entry = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr->descr_offset[i]);
         gemm_params_t *descr_params = &(descr_entry->gemm_params);
         descr_params->input_base = in_args->data_offset + i * (in_args->len);
@@ -336,9 +678,47 @@ void nn_module_register(nn_module *m) {
     HIGH_DEBUG(printf("[NN] input_queue_offset for model %s = %d\n", nn_module_get_name(m), edge->args->queue_offset);)
 
     #ifdef ENABLE_VAM
+    // Serve as many layers as possible from the warm pool
+    nn_module_use_pool(m);
+    // Request the hpthreads of all other layers with one VAM request; VAM places them in the background.
+    // Their input queues stay empty until the first request, so they do not touch the weights yet.
+    unsigned th_count;
+    hpthread_t **th_array = nn_module_hpthread_array(m, false, &th_count);
+    HIGH_DEBUG(printf("[NN%d] Before hpthread create for %d layers...\n", m->id, th_count));
+    hpthread_req_t *th_req = hpthread_create_n_async(th_array, th_count);
+    #endif
+
+    // Load the weights of each layer and complete its task descriptors
+    nn_node_t *layer;
+    while ((layer = nn_queue_pop(&layers)) != NULL) {
+        gemm_node_args *gemm_args = (gemm_node_args *) layer->args;
+        gemm_params_t *params = &(gemm_args->params);
+        // Weights, bias and packed weights, shared with the other modules of this model
+        nn_module_load_weights(m, layer, gemm_args);
+        nn_edge_args *in_args = layer->in_edges->e->args; nn_edge_args *out_args = layer->out_edges->e->args;
+        gemm_task_descr *descr = (gemm_task_descr *) ((unsigned *) (m->mem) + in_args->descr_offset);
+        for (unsigned i = 0; i < m->queue_depth; i++) {
+            gemm_queue_entry_t *descr_entry = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr->descr_offset[i]);
+            gemm_params_t *descr_params = &(descr_entry->gemm_params);
+            *descr_params = *params;
+            descr_params->input_base = in_args->data_offset + i * (in_args->len);
+            descr_params->output_base = out_args->data_offset + i * (out_args->len);
+            HIGH_DEBUG(print_gemm_entry(descr_entry);)
+        }
+    }
+
+    #ifdef ENABLE_VAM
+    hpthread_wait(th_req);
+    free(th_array);
     HIGH_DEBUG(print_hpthread_list(m);)
     #endif
 
+    // Later modules of the same model join this pool only if this much memory is left
+    pthread_mutex_lock(&nn_pool_lock);
+    if (m->mem_allocated > m->pool->tenant_words) m->pool->tenant_words = m->mem_allocated;
+    pthread_mutex_unlock(&nn_pool_lock);
+    LOW_DEBUG(printf("[NN%d] Module memory: %d private words, %d of %d words used in the pool\n", m->id, m->mem_allocated, m->pool->allocated, m->pool->size);)
+
     // Clean up temporary data structures
     free(queue_list);
     nn_queue_delete(q);
@@ -355,15 +735,32 @@ void nn_module_load_and_register(nn_module *m, const char *n) {
     nn_module_register(m);
 }
 
+// Number of hpthreads a loaded model asks for when registered: one per GEMM layer, up to n_threads
+unsigned nn_module_hpthread_count(nn_module *m) {
+    unsigned count = 0;
+    for (nn_node_list *cur = m->graph->nodes; cur != NULL; cur = cur->next)
+        if (nn_node_get_op(cur->n) == NN_OP_GEMM) count++;
+    return (m->n_threads > 0 && m->n_threads < count) ? m->n_threads : count;
+}
+
 // Release the resources for this model
 void nn_module_release(nn_module *m) {
     #ifdef ENABLE_VAM
+    unsigned th_count;
+    hpthread_t **th_array = nn_module_hpthread_array(m, false, &th_count);
+    hpthread_join_n(th_array, th_count);
+    free(th_array);
+    // Park pooled hpthreads again instead of joining them
+    th_array = nn_module_hpthread_array(m, true, &th_count);
+    hpthread_pool_put_n(th_array, th_count);
+    free(th_array);
     nn_hpthread_list *cur = m->th_list;
     while(cur != NULL) {
         nn_hpthread_list *next = cur->next;
-        hpthread_join(cur->th);
-        free(cur->th->args);
-        free(cur->th);
+        if (!cur->th->pooled) {
+            free(cur->th->args);
+            free(cur->th);
+        }
         free(cur);
         cur = next;
     }
@@ -376,8 +773,10 @@ void nn_module_release(nn_module *m) {
         cur = next;
     }
     #endif
-    esp_free(m->mem);
+    nn_mem_pool_detach(m->pool);
     nn_graph_delete(m->graph);
+    pthread_mutex_destroy(&m->req_lock);
+    pthread_mutex_destroy(&m->rsp_lock);
 }
 
 void nn_module_setprio(nn_module *m, unsigned nprio) {
@@ -403,6 +802,19 @@ void nn_module_add_hpthread(nn_module *m, hpthread_t *th) {
     list->next = item;
 }
 
+// Collect the hpthreads of the module that are (or are not) from the warm pool into an array
+// (freed by the caller) for the batched calls
+hpthread_t **nn_module_hpthread_array(nn_module *m, bool pooled, unsigned *n) {
+    *n = 0;
+    for (nn_hpthread_list *cur = m->th_list; cur; cur = cur->next) (*n)++;
+    hpthread_t **th = (hpthread_t **) malloc(sizeof(hpthread_t *) * (*n + 1));
+    *n = 0;
+    for (nn_hpthread_list *cur = m->th_list; cur; cur = cur->next) {
+        if (cur->th->pooled == pooled) th[(*n)++] = cur->th;
+    }
+    return th;
+}
+
 void nn_module_setpriority(nn_module *m, unsigned nprio) {
     nn_hpthread_list *cur = m->th_list;
     while(cur != NULL) {
@@ -435,8 +847,9 @@ void nn_module_run(nn_module *m, nn_token_t *input_data, nn_token_t *output_data
     }
     for (unsigned loop_count = 0; loop_count < m->loop_around; loop_count++) {
         HIGH_DEBUG(printf("[NN%d] Programming PRIM_GEMM descr at %lu for req %d...\n", m->id, descr_offset, m->req_cnt););
+        __atomic_fetch_add(&m->slots_reserved, 1, __ATOMIC_RELAXED);
         sm_queue_push(in_q, descr_offset);
-        while(sm_queue_empty(out_q)) { SCHED_YIELD; }
+        SM_QUEUE_WAIT_UNTIL(out_q, SM_QUEUE_PUSHED, !sm_queue_empty(out_q));
         descr_offset = sm_queue_pop(out_q);
     }
     if (real_data) {
@@ -480,7 +893,13 @@ void nn_module_run(nn_module *m, nn_token_t *input_data, nn_token_t *output_data
                     init_done = true;
                 }
                 HIGH_DEBUG(printf("[NN%d] Programming PRIM_GEMM descr at %lu for req %d...\n", m->id, descr_offset, m->req_cnt););
-                gemm_run(accel, descr_entry);
+                if (descr_entry->gemm_params.prec != GEMM_PREC_Q32) {
+                    // Quantized weights cannot be read by the accelerator
+                    gemm_params_run((nn_token_t *) (m->mem), &(descr_entry->gemm_params));
+                } else {
+                    gemm_run(accel, descr_entry);
+                    gemm_params_epilogue((nn_token_t *) (m->mem), &(descr_entry->gemm_params));
+                }
                 m->active_cycles += accel->context_active_cycles[0];
             }
             default: break;
@@ -500,13 +919,43 @@ void nn_module_run(nn_module *m, nn_token_t *input_data, nn_token_t *output_data
     #endif
 }
 
+// Admit up to n requests that take per input queue slots each; returns how many were admitted
+// -- clients race on the reservation counter, so it is advanced by CAS
+static unsigned nn_module_admit(nn_module *m, unsigned n, unsigned per) {
+    uint64_t *tail_ptr = sm_queue_tail_ptr(m->input_queue);
+    uint64_t reserved;
+    unsigned count;
+    do {
+        // Read the tail first so that it cannot run ahead of the reservations
+        uint64_t tail = __atomic_load_n(tail_ptr, __ATOMIC_ACQUIRE);
+        reserved = __atomic_load_n(&m->slots_reserved, __ATOMIC_ACQUIRE);
+        unsigned used = (unsigned) (reserved - tail);
+        HIGH_DEBUG(printf("[NN%d] Input queue slots in use = %d\n", m->id, used););
+        count = 0;
+        while (count < n && used + count * per < m->queue_depth) count++; // backpressure
+        if (count == 0) return 0;
+    } while (!__atomic_compare_exchange_n(&m->slots_reserved, &reserved, reserved + count * per, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return count;
+}
+
+// Push admitted descriptors, waiting for the consumer to give back the slots they were admitted to
+static void nn_module_push(nn_module *m, sm_queue_t *q, const uint64_t *descr_offset, unsigned count) {
+    bool locked = nn_module_lock(m, q, &m->req_lock);
+    unsigned pushed = sm_queue_push_n(q, descr_offset, count);
+    while (pushed < count) {
+        SM_QUEUE_WAIT_UNTIL(q, SM_QUEUE_POPPED, sm_queue_room(q, 1));
+        pushed += sm_queue_push_n(q, &descr_offset[pushed], count - pushed);
+    }
+    if (locked) pthread_mutex_unlock(&m->req_lock);
+}
+
 void nn_module_req(nn_module *m, nn_token_t *input_data, unsigned data_len, bool real_data) {
     HIGH_DEBUG(printf("[NN%d] Starting nn_module_req for %s\n", m->id, nn_module_get_name(m)));
-    // Try to enqueue the first descriptor (for req_cnt_in) to the input_queue
+    // Wait for a slot in the input_queue, then take the next request's descriptor
     nn_task_descr *descr_list = m->descr_list;
     uint64_t descr_offset;
-    sm_queue_t *in_q = m->input_queue;
-    unsigned req = (m->req_cnt++) % SM_QUEUE_SIZE;
+    SM_QUEUE_WAIT_UNTIL(m->input_queue, SM_QUEUE_POPPED, nn_module_admit(m, 1, 1)); // nn_module_rsp does not requeue
+    unsigned req = __atomic_fetch_add(&m->req_cnt, 1, __ATOMIC_RELAXED) % m->queue_depth;
     switch(descr_list->prim) {
         case PRIM_GEMM: {
             gemm_task_descr *descr = (gemm_task_descr *) descr_list;
@@ -515,7 +964,6 @@ void nn_module_req(nn_module *m, nn_token_t *input_data, unsigned data_len, bool
         default: break;
     }
     HIGH_DEBUG(printf("[NN%d] Programming PRIM_GEMM descr at %lu for req %d...\n", m->id, descr_offset, req););
-    while(sm_queue_full(in_q)) { SCHED_YIELD; }
     if (real_data) {
         nn_token_t *input_addr;
         // TODO: assumes it is a GEMM task
@@ -523,80 +971,87 @@ void nn_module_req(nn_module *m, nn_token_t *input_data, unsigned data_len, bool
         input_addr = (nn_token_t *) ((unsigned *) (m->mem) + descr->gemm_params.input_base);
         memcpy(input_addr, input_data, data_len);
     }
-    sm_queue_push(in_q, descr_offset);
+    nn_module_push(m, m->input_queue, &descr_offset, 1);
     HIGH_DEBUG(printf("[NN%d] Enqueued descr to module %s.\n", m->id, nn_module_get_name(m)));
 }
 
 bool nn_module_req_check(nn_module *m, nn_token_t *input_data, unsigned data_len) {
-    HIGH_DEBUG(printf("[NN%d] Starting nn_module_req_check for %s\n", m->id, nn_module_get_name(m)));
-    sm_queue_t *in_q = m->input_queue;
-    if (m->loop_around > 1) {
-        unsigned level = sm_queue_level(in_q);
-        HIGH_DEBUG(printf("[NN%d] Current input queue level = %d, pending requeues = %d\n", m->id, level, m->pending_requeues););
-        if (level + m->pending_requeues >= SM_QUEUE_SIZE) return false; // backpressure
-    } else if (sm_queue_full(in_q)) {
-        return false;
-    }
-    // Try to enqueue the first descriptor (for req_cnt_in) to the input_queue
+    return nn_module_req_check_n(m, 1) == 1;
+}
+
+unsigned nn_module_req_check_n(nn_module *m, unsigned n) {
+    HIGH_DEBUG(printf("[NN%d] Starting nn_module_req_check_n(%d) for %s\n", m->id, n, nn_module_get_name(m)));
+    // Each request takes one slot plus (loop_around - 1) reserved for its requeues
+    unsigned count = nn_module_admit(m, n, m->loop_around);
+    if (count == 0) return 0;
+    // Enqueue the first descriptor of every request (req_cnt onwards) to the input_queue at once
+    uint64_t descr_offset[count];
     nn_task_descr *descr_list = m->descr_list;
-    uint64_t descr_offset;
-    unsigned req = (m->req_cnt++) % SM_QUEUE_SIZE;
-    switch(descr_list->prim) {
-        case PRIM_GEMM: {
-            gemm_task_descr *descr = (gemm_task_descr *) descr_list;
-            descr_offset = descr->descr_offset[req];
-        }    
-        default: break;
-    }
-    HIGH_DEBUG(printf("[NN%d] Programming PRIM_GEMM descr at %lu for req %d...\n", m->id, descr_offset, req););
-    if (m->loop_around > 1) {
-        m->pending_requeues += (m->loop_around - 1); // reserve slots for requeues
-        HIGH_DEBUG(printf("[NN%d] Reserved %d slots for module %s.\n", m->id, m->pending_requeues, nn_module_get_name(m)));
+    unsigned first = __atomic_fetch_add(&m->req_cnt, count, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < count; i++) {
+        unsigned req = (first + i) % m->queue_depth;
+        switch(descr_list->prim) {
+            case PRIM_GEMM: {
+                gemm_task_descr *descr = (gemm_task_descr *) descr_list;
+                descr_offset[i] = descr->descr_offset[req];
+            }
+            default: break;
+        }
+        HIGH_DEBUG(printf("[NN%d] Programming PRIM_GEMM descr at %lu for req %d...\n", m->id, descr_offset[i], req););
     }
-    sm_queue_push(in_q, descr_offset);
-    HIGH_DEBUG(printf("[NN%d] Enqueued descr to module %s.\n", m->id, nn_module_get_name(m)));
-    return true;
+    nn_module_push(m, m->input_queue, descr_offset, count);
+    HIGH_DEBUG(printf("[NN%d] Enqueued %d descr to module %s.\n", m->id, count, nn_module_get_name(m)));
+    return count;
 }
 
 void nn_module_rsp(nn_module *m, nn_token_t *output_data, unsigned data_len, bool real_data) {
     sm_queue_t *out_q = m->output_queue;
-    uint64_t descr_offset;
+    uint64_t pos, descr_offset;
     HIGH_DEBUG(printf("[NN%d] Dequeueing descr for module %s.\n", m->id, nn_module_get_name(m)));
-    while(sm_queue_empty(out_q)) { SCHED_YIELD; }
+    // The slot stays claimed until the output is copied, so the last stage cannot overwrite it
+    bool locked = nn_module_lock(m, out_q, &m->rsp_lock);
+    SM_QUEUE_WAIT_UNTIL(out_q, SM_QUEUE_PUSHED, sm_queue_claim(out_q, &pos, &descr_offset));
     if (real_data) {
         nn_token_t *output_addr;
-        uint64_t tail = out_q->tail;
-        descr_offset = out_q->entry[tail % SM_QUEUE_SIZE];
         // TODO: assumes it is a GEMM task
         gemm_queue_entry_t *descr = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr_offset);
         output_addr = (nn_token_t *) ((unsigned *) (m->mem) + descr->gemm_params.input_base);
         HIGH_DEBUG(printf("[NN%d] Output data to be read at %d for descr at %lu.\n", m->id, descr->gemm_params.input_base, descr_offset));
         memcpy(output_data, output_addr, data_len);
     }
-    sm_queue_pop(out_q);
+    sm_queue_release(out_q, pos);
+    if (locked) pthread_mutex_unlock(&m->rsp_lock);
     HIGH_DEBUG(printf("[NN%d] Dequeued descr at %lu for module %s.\n", m->id, descr_offset, nn_module_get_name(m)));
 }
 
 bool nn_module_rsp_check(nn_module *m, nn_token_t *output_data, unsigned data_len) {
-    HIGH_DEBUG(printf("[NN%d] Starting nn_module_rsp_check for %s\n", m->id, nn_module_get_name(m)));
+    return nn_module_rsp_check_n(m, 1) == 1;
+}
+
+unsigned nn_module_rsp_check_n(nn_module *m, unsigned n) {
+    HIGH_DEBUG(printf("[NN%d] Starting nn_module_rsp_check_n(%d) for %s\n", m->id, n, nn_module_get_name(m)));
     sm_queue_t *out_q = m->output_queue;
-    if (sm_queue_empty(out_q)) return false;
-    uint64_t descr_offset = sm_queue_pop(out_q);
-    HIGH_DEBUG(printf("[NN%d] Dequeued descr for module %s.\n", m->id, nn_module_get_name(m)));
-    gemm_queue_entry_t *descr = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr_offset);
-    if (descr->common.output_queue == 42424242) { // MAGIC number for last stage
-        HIGH_DEBUG(printf("[NN%d] Found 42424242 for module %s.\n", m->id, nn_module_get_name(m)));
-        return true;
-    } else {
-        sm_queue_t *in_q = m->input_queue;
-        while(sm_queue_full(in_q)) { SCHED_YIELD; }
-        sm_queue_push(in_q, descr_offset);
-        if (m->pending_requeues != 0) {
-            m->pending_requeues--;
-            HIGH_DEBUG(printf("[NN%d] Released 1 reserved slot for module %s. Remaining = %d\n", m->id, nn_module_get_name(m), m->pending_requeues);)
+    uint64_t descr_offset[m->queue_depth];
+    if (n > m->queue_depth) n = m->queue_depth;
+    bool locked = nn_module_lock(m, out_q, &m->rsp_lock);
+    n = sm_queue_pop_n(out_q, descr_offset, n);
+    if (locked) pthread_mutex_unlock(&m->rsp_lock);
+    if (n == 0) return 0;
+    HIGH_DEBUG(printf("[NN%d] Dequeued %d descr for module %s.\n", m->id, n, nn_module_get_name(m)));
+    // Finished requests are done; the others loop around to the input queue together,
+    // into the slots reserved when they were admitted
+    unsigned done = 0, requeues = 0;
+    for (unsigned i = 0; i < n; i++) {
+        gemm_queue_entry_t *descr = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr_offset[i]);
+        if (descr->common.output_queue == 42424242) { // MAGIC number for last stage
+            HIGH_DEBUG(printf("[NN%d] Found 42424242 for module %s.\n", m->id, nn_module_get_name(m)));
+            done++;
+        } else {
+            descr_offset[requeues++] = descr_offset[i];
         }
-        return false;
     }
+    if (requeues) nn_module_push(m, m->input_queue, descr_offset, requeues);
+    return done;
 }
 
 void nn_queue_push(nn_queue_t *q, nn_node_t *n) {
@@ -634,30 +1089,49 @@ bool nn_set_add_node(nn_node_list **s, nn_node_t *n) {
 }
 
 void initialize_data(const char *input_file, nn_token_t *mem, unsigned len) {
+    // Binary weight files are copied in directly; anything else is parsed as text
+    if (input_file[0] != '\n') {
+        int ret = nn_weights_load(input_file, mem, len);
+        if (ret == 0) return;
+        if (ret < 0) exit(1);
+    }
+
+    // Values are staged as floats and converted to tokens in one bulk pass
+    float *data = (float *) malloc(len * sizeof(float));
     if (input_file[0] == '\n') {
         HIGH_DEBUG(printf("[NN] Initializing %d words with random input\n", len));
         const float float_min = 0.0f, float_max = 1.0f;
         for (unsigned i = 0; i < len; i++)
-            mem[i] = nn_token_from_float(float_min + ((float)rand() / (float)RAND_MAX) * (float_max - float_min));
+            data[i] = float_min + ((float)rand() / (float)RAND_MAX) * (float_max - float_min);
     } else {
         FILE *file = fopen(input_file, "r");
 
         HIGH_DEBUG(printf("[NN] Initializing %d words from %s\n", len, input_file));
         for (unsigned i = 0; i < len; i++) {
-            float in;
-            if (fscanf(file, "%f ", &in) != 1) {
+            if (fscanf(file, "%f ", &data[i]) != 1) {
                 perror("Error reading input data file!");
                 exit(1);
             }
-            mem[i] = nn_token_from_float(in);
 
             #if 0
-                if (i < 10) printf("%f ", in);
+                if (i < 10) printf("%f ", data[i]);
                 if (i == 10) printf("\n");
             #endif
         }
         fclose(file);
     }
+    nn_tokens_from_floats(mem, data, len);
+    free(data);
+}
+
+// Synthetic data in [0, 1) from its own generator, so the same seed gives the same values
+void initialize_random(nn_token_t *mem, unsigned len, unsigned seed) {
+    HIGH_DEBUG(printf("[NN] Initializing %d words with random input (seed %d)\n", len, seed));
+    float *data = (float *) malloc(len * sizeof(float));
+    for (unsigned i = 0; i < len; i++)
+        data[i] = (float) rand_r(&seed) / (float) RAND_MAX;
+    nn_tokens_from_floats(mem, data, len);
+    free(data);
 }
 
 void nn_module_add_task_descr(nn_module *m, nn_task_descr *descr) {
@@ -671,6 +1145,39 @@ void nn_module_add_task_descr(nn_module *m, nn_task_descr *descr) {
     p->next = descr;
 }
 
+#ifdef DO_QUEUE_STATS
+sm_queue_stats_t *nn_module_edge_stats(nn_module *m, nn_edge_t *e) {
+    return sm_queue_stats((sm_queue_t *) ((unsigned *) (m->mem) + e->args->queue_offset));
+}
+
+void nn_module_reset_queue_stats(nn_module *m) {
+    for (nn_node_t *node = nn_graph_get_entry(m->graph); node->out_edges; node = nn_edge_get_destination(node->out_edges->e)) {
+        sm_queue_stats_reset((sm_queue_t *) ((unsigned *) (m->mem) + node->out_edges->e->args->queue_offset));
+    }
+}
+
+void nn_module_print_queue_stats(nn_module *m) {
+    printf("[NN%d] Queue stats for model %s (depth %d)\n", m->id, nn_module_get_name(m), m->queue_depth);
+    // Walk the pipeline from the entry; assumes single producer, single consumer
+    for (nn_node_t *node = nn_graph_get_entry(m->graph); node->out_edges; node = nn_edge_get_destination(node->out_edges->e)) {
+        nn_edge_t *e = node->out_edges->e;
+        sm_queue_stats_t *st = nn_module_edge_stats(m, e);
+        printf("\t[E%d->%d]", node->id, nn_edge_get_destination(e)->id);
+        if (!st) {
+            printf(" no stats (plain layout)\n");
+            continue;
+        }
+        printf(" pushes=%lu pops=%lu max_level=%lu full_stalls=%lu (%.3f ms)", st->pushes, st->pops, st->max_level, st->full_stalls, st->full_stall_ns / 1e6);
+        printf(" residence avg=%.3f ms max=%.3f ms\n", st->pops ? st->residence_ns / 1e6 / st->pops : 0.0, st->residence_max_ns / 1e6);
+        printf("\t\tentries ahead at push:");
+        for (unsigned b = 0; b < SM_QUEUE_HIST; b++) {
+            if (st->hist[b]) printf(" [%u-%u]=%lu", b ? 1u << (b - 1) : 0, b ? (1u << b) - 1 : 0, st->hist[b]);
+        }
+        printf("\n");
+    }
+}
+#endif
+
 void print_descr_list(nn_module *m) {
     printf("[NN%d] Printing task descriptor for model %s...\n", m->id, nn_module_get_name(m));
     nn_task_descr *descr_list = m->descr_list;
@@ -680,7 +1187,7 @@ void print_descr_list(nn_module *m) {
         switch(descr_list->prim) {
             case PRIM_GEMM: {
                 gemm_task_descr *descr = (gemm_task_descr *) descr_list;
-                for (int i = 0; i < SM_QUEUE_SIZE; i++) {
+                for (unsigned i = 0; i < m->queue_depth; i++) {
                     gemm_queue_entry_t *descr_entry = (gemm_queue_entry_t *) ((unsigned *) (m->mem) + descr->descr_offset[i]);
                     printf("\t[D%d] dim_m=%d\n", count, descr_entry->gemm_params.dim_m);
                     printf("\t[D%d] dim_n=%d\n", count, descr_entry->gemm_params.dim_n);
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <nn_token.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+#include <riscv_vector.h>
+#endif
+
+////////////////////////////////////
+// Bulk conversions between float and 16.16 tokens
+// -- every vector path gives the same bits as the scalar nn_token_* helpers: float to token
+// -- scales and truncates toward zero (the _rn variant adds +/-0.5 first), token to float
+// -- converts with round-to-nearest and scales by the exact power of two.
+
+#define NN_INV_SCALE (1.0f / (float) NN_SCALE)
+
+static void nn_tokens_from_floats_scalar(nn_token_t *dst, const float *src, unsigned len) {
+    for (unsigned i = 0; i < len; i++) dst[i] = nn_token_from_float(src[i]);
+}
+
+static void nn_tokens_from_floats_rn_scalar(nn_token_t *dst, const float *src, unsigned len) {
+    for (unsigned i = 0; i < len; i++) dst[i] = nn_token_from_float_rn(src[i]);
+}
+
+static void nn_tokens_to_floats_scalar(float *dst, const nn_token_t *src, unsigned len) {
+    for (unsigned i = 0; i < len; i++) dst[i] = nn_token_to_float(src[i]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void nn_tokens_from_floats_avx2(nn_token_t *dst, const float *src, unsigned len) {
+    const __m256 scale = _mm256_set1_ps((float) NN_SCALE);
+    unsigned i = 0;
+    for (; i + 8 <= len; i += 8)
+        _mm256_storeu_si256((__m256i *) &dst[i], _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&src[i]), scale)));
+    nn_tokens_from_floats_scalar(&dst[i], &src[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static void nn_tokens_from_floats_rn_avx2(nn_token_t *dst, const float *src, unsigned len) {
+    const __m256 scale = _mm256_set1_ps((float) NN_SCALE);
+    const __m256 zero = _mm256_setzero_ps(), pos_half = _mm256_set1_ps(0.5f), neg_half = _mm256_set1_ps(-0.5f);
+    unsigned i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(&src[i]), scale);
+        __m256 half = _mm256_blendv_ps(neg_half, pos_half, _mm256_cmp_ps(scaled, zero, _CMP_GE_OQ));
+        _mm256_storeu_si256((__m256i *) &dst[i], _mm256_cvttps_epi32(_mm256_add_ps(scaled, half)));
+    }
+    nn_tokens_from_floats_rn_scalar(&dst[i], &src[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static void nn_tokens_to_floats_avx2(float *dst, const nn_token_t *src, unsigned len) {
+    const __m256 inv_scale = _mm256_set1_ps(NN_INV_SCALE);
+    unsigned i = 0;
+    for (; i + 8 <= len; i += 8)
+        _mm256_storeu_ps(&dst[i], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) &src[i])), inv_scale));
+    nn_tokens_to_floats_scalar(&dst[i], &src[i], len - i);
+}
+
+__attribute__((target("avx512f")))
+static void nn_tokens_from_floats_avx512(nn_token_t *dst, const float *src, unsigned len) {
+    const __m512 scale = _mm512_set1_ps((float) NN_SCALE);
+    unsigned i = 0;
+    for (; i + 16 <= len; i += 16)
+        _mm512_storeu_si512((void *) &dst[i], _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_loadu_ps(&src[i]), scale)));
+    nn_tokens_from_floats_avx2(&dst[i], &src[i], len - i);
+}
+
+__attribute__((target("avx512f")))
+static void nn_tokens_from_floats_rn_avx512(nn_token_t *dst, const float *src, unsigned len) {
+    const __m512 scale = _mm512_set1_ps((float) NN_SCALE);
+    const __m512 pos_half = _mm512_set1_ps(0.5f), neg_half = _mm512_set1_ps(-0.5f);
+    unsigned i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m512 scaled = _mm512_mul_ps(_mm512_loadu_ps(&src[i]), scale);
+        __mmask16 non_neg = _mm512_cmp_ps_mask(scaled, _mm512_setzero_ps(), _CMP_GE_OQ);
+        __m512 half = _mm512_mask_blend_ps(non_neg, neg_half, pos_half);
+        _mm512_storeu_si512((void *) &dst[i], _mm512_cvttps_epi32(_mm512_add_ps(scaled, half)));
+    }
+    nn_tokens_from_floats_rn_avx2(&dst[i], &src[i], len - i);
+}
+
+__attribute__((target("avx512f")))
+static void nn_tokens_to_floats_avx512(float *dst, const nn_token_t *src, unsigned len) {
+    const __m512 inv_scale = _mm512_set1_ps(NN_INV_SCALE);
+    unsigned i = 0;
+    for (; i + 16 <= len; i += 16)
+        _mm512_storeu_ps(&dst[i], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_loadu_si512((const void *) &src[i])), inv_scale));
+    nn_tokens_to_floats_avx2(&dst[i], &src[i], len - i);
+}
+
+// 0 = scalar, 1 = AVX2, 2 = AVX-512; detected once
+static int nn_token_isa() {
+    static int isa = -1;
+    int v = __atomic_load_n(&isa, __ATOMIC_RELAXED);
+    if (v < 0) {
+        __builtin_cpu_init();
+        v = __builtin_cpu_supports("avx512f") ? 2 : (__builtin_cpu_supports("avx2") ? 1 : 0);
+        __atomic_store_n(&isa, v, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+static void nn_tokens_from_floats_neon(nn_token_t *dst, const float *src, unsigned len) {
+    unsigned i = 0;
+    for (; i + 4 <= len; i += 4)
+        vst1q_s32((int32_t *) &dst[i], vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&src[i]), (float) NN_SCALE)));
+    nn_tokens_from_floats_scalar(&dst[i], &src[i], len - i);
+}
+
+static void nn_tokens_from_floats_rn_neon(nn_token_t *dst, const float *src, unsigned len) {
+    const float32x4_t pos_half = vdupq_n_f32(0.5f), neg_half = vdupq_n_f32(-0.5f);
+    unsigned i = 0;
+    for (; i + 4 <= len; i += 4) {
+        float32x4_t scaled = vmulq_n_f32(vld1q_f32(&src[i]), (float) NN_SCALE);
+        float32x4_t half = vbslq_f32(vcgeq_f32(scaled, vdupq_n_f32(0.0f)), pos_half, neg_half);
+        vst1q_s32((int32_t *) &dst[i], vcvtq_s32_f32(vaddq_f32(scaled, half)));
+    }
+    nn_tokens_from_floats_rn_scalar(&dst[i], &src[i], len - i);
+}
+
+static void nn_tokens_to_floats_neon(float *dst, const nn_token_t *src, unsigned len) {
+    unsigned i = 0;
+    for (; i + 4 <= len; i += 4)
+        vst1q_f32(&dst[i], vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t *) &src[i])), NN_INV_SCALE));
+    nn_tokens_to_floats_scalar(&dst[i], &src[i], len - i);
+}
+#endif
+
+#if defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+static void nn_tokens_from_floats_rvv(nn_token_t *dst, const float *src, unsigned len) {
+    for (unsigned i = 0; i < len; ) {
+        size_t vl = __riscv_vsetvl_e32m4(len - i);
+        vfloat32m4_t scaled = __riscv_vfmul_vf_f32m4(__riscv_vle32_v_f32m4(&src[i], vl), (float) NN_SCALE, vl);
+        __riscv_vse32_v_i32m4((int32_t *) &dst[i], __riscv_vfcvt_rtz_x_f_v_i32m4(scaled, vl), vl);
+        i += vl;
+    }
+}
+
+static void nn_tokens_from_floats_rn_rvv(nn_token_t *dst, const float *src, unsigned len) {
+    for (unsigned i = 0; i < len; ) {
+        size_t vl = __riscv_vsetvl_e32m4(len - i);
+        vfloat32m4_t scaled = __riscv_vfmul_vf_f32m4(__riscv_vle32_v_f32m4(&src[i], vl), (float) NN_SCALE, vl);
+        vbool8_t non_neg = __riscv_vmfge_vf_f32m4_b8(scaled, 0.0f, vl);
+        vfloat32m4_t half = __riscv_vfmerge_vfm_f32m4(__riscv_vfmv_v_f_f32m4(-0.5f, vl), 0.5f, non_neg, vl);
+        __riscv_vse32_v_i32m4((int32_t *) &dst[i], __riscv_vfcvt_rtz_x_f_v_i32m4(__riscv_vfadd_vv_f32m4(scaled, half, vl), vl), vl);
+        i += vl;
+    }
+}
+
+static void nn_tokens_to_floats_rvv(float *dst, const nn_token_t *src, unsigned len) {
+    for (unsigned i = 0; i < len; ) {
+        size_t vl = __riscv_vsetvl_e32m4(len - i);
+        vfloat32m4_t f = __riscv_vfcvt_f_x_v_f32m4(__riscv_vle32_v_i32m4((const int32_t *) &src[i], vl), vl);
+        __riscv_vse32_v_f32m4(&dst[i], __riscv_vfmul_vf_f32m4(f, NN_INV_SCALE, vl), vl);
+        i += vl;
+    }
+}
+#endif
+
+void nn_tokens_from_floats(nn_token_t *dst, const float *src, unsigned len) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (nn_token_isa()) {
+        case 2: nn_tokens_from_floats_avx512(dst, src, len); return;
+        case 1: nn_tokens_from_floats_avx2(dst, src, len); return;
+        default: break;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    nn_tokens_from_floats_neon(dst, src, len); return;
+#elif defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+    nn_tokens_from_floats_rvv(dst, src, len); return;
+#endif
+    nn_tokens_from_floats_scalar(dst, src, len);
+}
+
+void nn_tokens_from_floats_rn(nn_token_t *dst, const float *src, unsigned len) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (nn_token_isa()) {
+        case 2: nn_tokens_from_floats_rn_avx512(dst, src, len); return;
+        case 1: nn_tokens_from_floats_rn_avx2(dst, src, len); return;
+        default: break;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    nn_tokens_from_floats_rn_neon(dst, src, len); return;
+#elif defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+    nn_tokens_from_floats_rn_rvv(dst, src, len); return;
+#endif
+    nn_tokens_from_floats_rn_scalar(dst, src, len);
+}
+
+void nn_tokens_to_floats(float *dst, const nn_token_t *src, unsigned len) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (nn_token_isa()) {
+        case 2: nn_tokens_to_floats_avx512(dst, src, len); return;
+        case 1: nn_tokens_to_floats_avx2(dst, src, len); return;
+        default: break;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    nn_tokens_to_floats_neon(dst, src, len); return;
+#elif defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+    nn_tokens_to_floats_rvv(dst, src, len); return;
+#endif
+    nn_tokens_to_floats_scalar(dst, src, len);
+}
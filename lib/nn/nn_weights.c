@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <common_defines.h>
+#include <nn_weights.h>
+
+////////////////////////////////////
+// Binary weight files
+// -- the file is mapped read-only and copied into module memory in a single pass that also
+// -- computes the checksum, so every weight is touched exactly once. The lanes are
+// -- independent, which lets the compiler keep them in one vector register each.
+
+// Copy len tokens from src to dst (dst may be NULL) and return their checksum
+static uint64_t nn_weights_copy(nn_token_t *dst, const nn_token_t *src, unsigned len) {
+    uint64_t s1[NN_WEIGHTS_LANES] = { 0 }, s2[NN_WEIGHTS_LANES] = { 0 };
+    unsigned i = 0;
+    for (; i + NN_WEIGHTS_LANES <= len; i += NN_WEIGHTS_LANES) {
+        for (unsigned j = 0; j < NN_WEIGHTS_LANES; j++) {
+            uint32_t w = (uint32_t) src[i + j].value;
+            if (dst) dst[i + j] = src[i + j];
+            s1[j] += w;
+            s2[j] += s1[j];
+        }
+    }
+    for (unsigned j = 0; i < len; i++, j++) {
+        if (dst) dst[i] = src[i];
+        s1[j] += (uint32_t) src[i].value;
+        s2[j] += s1[j];
+    }
+    uint64_t h = 0;
+    for (unsigned j = 0; j < NN_WEIGHTS_LANES; j++) {
+        h = h * 31 + s1[j];
+        h = h * 31 + s2[j];
+    }
+    return h;
+}
+
+uint64_t nn_weights_checksum(const nn_token_t *data, unsigned len) {
+    return nn_weights_copy(NULL, data, len);
+}
+
+int nn_weights_load(const char *path, nn_token_t *dst, unsigned len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(nn_weights_header_t)) {
+        close(fd);
+        return 1;
+    }
+    char magic[4];
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, NN_WEIGHTS_MAGIC, sizeof(magic))) {
+        close(fd);
+        return 1;
+    }
+
+#ifdef MAP_POPULATE
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("[NN] Failed to map weight file");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const nn_weights_header_t *hdr = (const nn_weights_header_t *) map;
+    int ret = -1;
+    if (hdr->version != NN_WEIGHTS_VERSION || hdr->dtype != NN_WEIGHTS_Q16_16) {
+        printf("[NN] %s: unsupported version %d / dtype %d\n", path, hdr->version, hdr->dtype);
+    } else if ((uint64_t) hdr->rows * hdr->cols != len) {
+        printf("[NN] %s: shape %dx%d does not match %d words\n", path, hdr->rows, hdr->cols, len);
+    } else if (hdr->data_offset < sizeof(nn_weights_header_t) || hdr->data_offset % sizeof(nn_token_t) ||
+               hdr->data_offset + (uint64_t) len * sizeof(nn_token_t) > (uint64_t) st.st_size) {
+        printf("[NN] %s: truncated file\n", path);
+    } else {
+        const nn_token_t *src = (const nn_token_t *) ((const char *) map + hdr->data_offset);
+        if (nn_weights_copy(dst, src, len) != hdr->checksum) {
+            printf("[NN] %s: checksum mismatch\n", path);
+        } else {
+            HIGH_DEBUG(printf("[NN] Loaded %dx%d weights from %s\n", hdr->rows, hdr->cols, path);)
+            ret = 0;
+        }
+    }
+    munmap(map, st.st_size);
+    return ret;
+}
+
+uint64_t nn_weights_file_key(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    nn_weights_header_t hdr;
+    bool binary = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && !memcmp(hdr.magic, NN_WEIGHTS_MAGIC, sizeof(hdr.magic));
+    close(fd);
+    if (binary) return hdr.checksum;
+    // Text weights are not read here: the size and modification time tell versions apart
+    uint64_t key = 0xcbf29ce484222325ull;
+    key = (key ^ (uint64_t) st.st_size) * 0x100000001b3ull;
+    key = (key ^ (uint64_t) st.st_mtim.tv_sec) * 0x100000001b3ull;
+    key = (key ^ (uint64_t) st.st_mtim.tv_nsec) * 0x100000001b3ull;
+    return key;
+}
+
+int nn_weights_write(const char *path, const nn_token_t *data, unsigned rows, unsigned cols) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    unsigned len = rows * cols;
+    nn_weights_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, NN_WEIGHTS_MAGIC, sizeof(hdr.magic));
+    hdr.version = NN_WEIGHTS_VERSION;
+    hdr.dtype = NN_WEIGHTS_Q16_16;
+    hdr.rows = rows;
+    hdr.cols = cols;
+    hdr.data_offset = sizeof(nn_weights_header_t);
+    hdr.checksum = nn_weights_checksum(data, len);
+    int ret = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 || fwrite(data, sizeof(nn_token_t), len, f) != len) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+    return ret;
+}
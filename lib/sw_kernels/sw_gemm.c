@@ -1,106 +1,406 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <common_helper.h>
 #include <hpthread.h>
-#include <gemm_params.h>
+#include <gemm_queue.h>
 #include <nn_token.h>
 #include <sw_gemm.h>
-#include <pthread.h>
+#include <sw_gemm_kernels.h>
 
 // Wrapper for GEMM to be mapped for the hpthread
+// -- software counterpart of the accelerator: drains the hpthread's task queue,
+// -- runs the GEMM on the CPU and forwards the output entry to the next queue.
 void *sw_gemm(void *a) {
-    printf("[SW GEMM] Started software thread for GeMM!\n");
+    hpthread_args_t *args = (hpthread_args_t *) a;
+    unsigned bind = hpthread_args_bind(args);
+    unsigned *mem = (unsigned *) args->mem;
+    sm_queue_t *q = (sm_queue_t *) &mem[args->queue_ptr];
+    bool *kill_pthread = args->kill_pthread;
+    LOW_DEBUG(printf("[SW GEMM] Started software thread for GeMM on queue %d!\n", args->queue_ptr);)
+    // Set queue to busy
+    if (sm_queue_get_stat(q) == QUEUE_BUSY) { SCHED_YIELD; };
+    sm_queue_set_stat(q, QUEUE_BUSY);
+    hpthread_args_ack(args, bind);
+    HIGH_DEBUG(unsigned invoke_count = 0;)
+
+    while (1) {
+        if (__atomic_load_n(kill_pthread, __ATOMIC_ACQUIRE)) {
+            sm_queue_set_stat(q, QUEUE_AVAIL);
+            HIGH_DEBUG(printf("[SW GEMM] Terminating software thread on queue %d\n", args->queue_ptr);)
+            pthread_exit(NULL);
+        }
+        // Switch to the new queue if the hpthread was rebound; no task is in flight here
+        if (hpthread_args_rebound(args, bind)) {
+            sm_queue_set_stat(q, QUEUE_AVAIL);
+            bind = hpthread_args_bind(args);
+            mem = (unsigned *) args->mem;
+            q = (sm_queue_t *) &mem[args->queue_ptr];
+            sm_queue_set_stat(q, QUEUE_BUSY);
+            hpthread_args_ack(args, bind);
+            HIGH_DEBUG(printf("[SW GEMM] Rebound software thread to queue %d\n", args->queue_ptr);)
+        }
+        // Is task queue empty?
+        if (!sm_queue_empty(q)) {
+            // Read descriptor from tail
+            unsigned descr_offset = sm_queue_can_pop(q);
+            gemm_queue_entry_t *e = (gemm_queue_entry_t *) &mem[descr_offset];
+            gemm_params_t *params = &(e->gemm_params);
+            HIGH_DEBUG(
+                printf("[SW GEMM] Printing GEMM descriptor at %d...\n", descr_offset);
+                print_gemm_entry(e);
+            )
+            // Wait for output queue to be not full
+            sm_queue_t *output_queue = (sm_queue_t *) &(mem[e->common.output_queue]);
+            uint64_t output_entry = e->common.output_entry;
+            SM_QUEUE_WAIT_UNTIL(output_queue, SM_QUEUE_POPPED, !sm_queue_full(output_queue) || __atomic_load_n(kill_pthread, __ATOMIC_ACQUIRE));
+            if (sm_queue_full(output_queue)) continue;
+            // Batch the tasks queued behind this one that reuse its weights and fit in the output queue
+            const gemm_params_t *batch[GEMM_BATCH_MAX];
+            uint64_t batch_output[GEMM_BATCH_MAX];
+            uint64_t pending[GEMM_BATCH_MAX];
+            unsigned output_space = sm_queue_room(output_queue, GEMM_BATCH_MAX);
+            unsigned n_pending = sm_queue_peek_n(q, pending, output_space);
+            unsigned batch_size = 1;
+            batch[0] = params;
+            batch_output[0] = output_entry;
+            while (batch_size < n_pending) {
+                gemm_queue_entry_t *next = (gemm_queue_entry_t *) &mem[pending[batch_size]];
+                if (next->common.output_queue != e->common.output_queue || !gemm_params_batchable(params, &(next->gemm_params))) break;
+                batch[batch_size] = &(next->gemm_params);
+                batch_output[batch_size] = next->common.output_entry;
+                batch_size++;
+            }
+            HIGH_DEBUG(printf("[SW GEMM] Starting GEMM %d (batch of %d) on queue %d\n", invoke_count, batch_size, args->queue_ptr);)
+
+            // Perform GeMM
+            if (batch_size == 1) {
+                gemm_params_run((nn_token_t *) mem, params);
+            } else {
+                gemm_params_run_batched((nn_token_t *) mem, batch, batch_size);
+            }
+
+            // Release the input entries only after the outputs are written, then push to output queue
+            sm_queue_pop_n(q, NULL, batch_size);
+            sm_queue_push_n(output_queue, batch_output, batch_size);
+            HIGH_DEBUG(invoke_count += batch_size; printf("[SW GEMM] Finished GEMM %d on queue %d\n", invoke_count - 1, args->queue_ptr);)
+        }
+        // Idle: wait for the next task (or to be killed or rebound)
+        SM_QUEUE_WAIT_UNTIL(q, SM_QUEUE_PUSHED, !sm_queue_empty(q) || __atomic_load_n(kill_pthread, __ATOMIC_ACQUIRE) || hpthread_args_rebound(args, bind));
+    }
+
     return NULL;
-    // hpthread_args_t *args = (hpthread_args_t *) a;
-    // nn_token_t *mem = (nn_token_t *) args->mem;
-    // unsigned *context_base_ptr = (unsigned *) &mem[args->base_ptr];
-    // bool *kill_pthread = args->kill_pthread;
-    // HIGH_DEBUG(unsigned iter = 0;)
-
-    // // Check if context base pointer is available
-    // while (context_base_ptr[0] != CTXT_AVAIL);
-    // unsigned *context_cur_ptr = (unsigned *) &mem[context_base_ptr[1]]; 
-        
-    // unsigned dim_m, dim_n, dim_k;
-    // unsigned mat_a_valid_offset, mat_c_valid_offset;
-    // unsigned mat_a_offset, mat_b_offset, mat_c_offset;
-
-    // while (1) {
-    //     if (context_cur_ptr[0] == 1) { // GEMM
-    //         gemm_params_t *params = (gemm_params_t *) &context_cur_ptr[1];
-    //         HIGH_DEBUG(
-    //             printf("[SW_GEMM] Printing GEMM descriptor... %p\n", &context_cur_ptr[0]);
-    //             print_descr(&context_cur_ptr[0]);
-    //         )
-    //         // Reading parameters from params
-    //         unsigned flag_len = PAYLOAD_OFFSET/sizeof(nn_token_t);
-    //         dim_m = params->dim_m;
-    //         dim_n = params->dim_n;
-    //         dim_k = params->dim_k;
-    //         mat_a_valid_offset = params->input_base;
-    //         mat_c_valid_offset = params->output_base;
-    //         mat_a_offset = mat_a_valid_offset + flag_len;
-    //         mat_b_offset = params->weight_base;
-    //         mat_c_offset = mat_c_valid_offset + flag_len;
-
-    //         context_cur_ptr += ACCEL_PARAM_SIZE;
-    //     } else if (context_cur_ptr[0] == 2) { // JUMP
-    //         HIGH_DEBUG(
-    //             printf("[SW_GEMM] Printing JUMP descriptor... %p\n", &context_cur_ptr[0]);
-    //             print_descr(&context_cur_ptr[0]);
-    //         )
-    //         context_cur_ptr = (unsigned *) &mem[context_cur_ptr[1]];
-    //         continue;
-    //     } else {
-    //         HIGH_DEBUG(printf("Bad descriptor %p!\n", &context_cur_ptr[0]);)
-    //         pthread_exit(NULL);
-    //     }
-
-    //     // We will cast the synchronization flags from *mem and atomically reset them
-    //     volatile uint64_t *input_flag = (volatile uint64_t *) &mem[mat_a_valid_offset];
-    //     volatile uint64_t *output_flag = (volatile uint64_t *) &mem[mat_c_valid_offset];
-
-    //     // Wait for inputs to be ready
-	// 	while(__atomic_load_n(input_flag, __ATOMIC_SEQ_CST) != 1) { if (*kill_pthread) pthread_exit(NULL); };
-    //     HIGH_DEBUG(printf("[SW_GEMM] Iteration %d received!\n", iter);)
-
-	// 	// Reset for next iteration.
-	// 	__atomic_store_n(input_flag, 0, __ATOMIC_SEQ_CST);
-
-    //     // Perform GeMM
-    //     gemm(&mem[mat_a_offset], &mem[mat_b_offset], &mem[mat_c_offset], dim_m, dim_n, dim_k);
-
-    //     // Set output to be full
-	// 	__atomic_store_n(output_flag, 1, __ATOMIC_SEQ_CST);
-    //     HIGH_DEBUG(printf("[SW_GEMM] Iteration %d complete!\n", iter++);)
-    // }
+}
+
+// Process-wide accumulation mode
+#ifdef DO_WIDE_ACCUM
+static unsigned gemm_accum = GEMM_ACCUM_WIDE;
+#else
+static unsigned gemm_accum = GEMM_ACCUM_NARROW;
+#endif
+
+void gemm_setaccum(unsigned mode) {
+    __atomic_store_n(&gemm_accum, mode, __ATOMIC_RELAXED);
+}
+
+unsigned gemm_getaccum() {
+    return __atomic_load_n(&gemm_accum, __ATOMIC_RELAXED);
+}
+
+// Options for the task described by params
+void gemm_params_opts(nn_token_t *mem, const gemm_params_t *params, gemm_opts_t *opts) {
+    opts->accum = gemm_getaccum();
+    opts->packed_b = (params->flags & GEMM_FLAG_PACKED) ? &mem[params->packed_base] : NULL;
+    opts->bias = (params->flags & GEMM_FLAG_BIAS) ? &mem[params->bias_base] : NULL;
+    opts->act = params->act;
+    opts->act_lo = nn_token_from_raw(params->act_lo);
+    opts->act_hi = nn_token_from_raw(params->act_hi);
+    opts->prec = params->prec;
+    opts->q_scale = params->q_scale;
+    opts->q_zero = params->q_zero;
+    opts->tune = gemm_tune_get(params->tune, params->dim_m, params->dim_n, params->dim_k);
+}
+
+void gemm_opts_default(gemm_opts_t *opts, const gemm_tune_t *tune) {
+    memset(opts, 0, sizeof(gemm_opts_t));
+    opts->accum = gemm_getaccum();
+    opts->tune = tune;
+}
+
+// Run the GEMM task described by params on the CPU
+void gemm_params_run(nn_token_t *mem, const gemm_params_t *params) {
+    gemm_opts_t opts;
+    gemm_params_opts(mem, params, &opts);
+    gemm_parallel(&mem[params->input_base], &mem[params->weight_base], &mem[params->output_base],
+                  params->dim_m, params->dim_n, params->dim_k, &opts);
+}
+
+// Run a batch of tasks that share weights and shape (see gemm_params_batchable)
+void gemm_params_run_batched(nn_token_t *mem, const gemm_params_t* const* params, unsigned batch) {
+    gemm_opts_t opts;
+    gemm_params_opts(mem, params[0], &opts);
+    const nn_token_t *mat_a[GEMM_BATCH_MAX];
+    nn_token_t *mat_c[GEMM_BATCH_MAX];
+    for (unsigned base = 0; base < batch; base += GEMM_BATCH_MAX) {
+        unsigned count = (batch - base < GEMM_BATCH_MAX) ? batch - base : GEMM_BATCH_MAX;
+        for (unsigned i = 0; i < count; i++) {
+            mat_a[i] = &mem[params[base + i]->input_base];
+            mat_c[i] = &mem[params[base + i]->output_base];
+        }
+        gemm_batched(mat_a, &mem[params[0]->weight_base], mat_c, count,
+                     params[0]->dim_m, params[0]->dim_n, params[0]->dim_k, &opts);
+    }
+}
+
+// Accelerators compute the plain GEMM; the bias and activation are applied on the host
+void gemm_params_epilogue(nn_token_t *mem, const gemm_params_t *params) {
+    if (!gemm_params_has_epilogue(params)) return;
+    gemm_opts_t opts;
+    gemm_params_opts(mem, params, &opts);
+    gemm_epilogue(&mem[params->output_base], params->dim_m, params->dim_n, &opts);
 }
 
 // Tiled matrix multiply
 void gemm(const nn_token_t* mat_a, const nn_token_t* mat_b, nn_token_t* mat_c, unsigned dim_m, unsigned dim_n, unsigned dim_k) {
-    const unsigned block_size = 16;
-    nn_token_t sum;
-
-	for (unsigned m = 0; m < dim_m; m += block_size) {
-	    for (unsigned n = 0; n < dim_n; n += block_size) {
-	        for (unsigned k = 0; k < dim_k; k += block_size) {
-
-                unsigned m_rem = (m + block_size < dim_m) ? m + block_size : dim_m;
-                unsigned n_rem = (n + block_size < dim_n) ? n + block_size : dim_n;
-                unsigned k_rem = (k + block_size < dim_k) ? k + block_size : dim_k;
-
-                for (unsigned m_ = m; m_ < m_rem; m_++) {
-                    for (unsigned n_ = n; n_ < n_rem; n_++) {
-                        if (k == 0) sum = nn_token_from_float(0.0F);
-                        else sum = mat_c[m_ * dim_n + n_];
-                        for (unsigned k_ = k; k_ < k_rem; k_++) {
-							sum = nn_token_add(sum, nn_token_mul(mat_a[m_ * dim_k + k_], mat_b[k_ * dim_n + n_]));
-                        }
-                        mat_c[m_ * dim_n + n_] = sum;
-                    }
+    gemm_ex(mat_a, mat_b, mat_c, dim_m, dim_n, dim_k, NULL);
+}
+
+bool gemm_opts_wide(const gemm_opts_t *opts) {
+    if (!opts) return gemm_getaccum() == GEMM_ACCUM_WIDE;
+    return opts->accum == GEMM_ACCUM_WIDE || opts->act == GEMM_ACT_SAT;
+}
+
+// Pick the microkernel for the requested accumulation mode
+gemm_ukernel_t gemm_select_ukernel(const gemm_opts_t *opts) {
+    const gemm_kernel_ops_t *ops = gemm_get_kernel();
+    return gemm_opts_wide(opts) ? ops->wide : ops->narrow;
+}
+
+// Saturating bias add, then the activation bounds; the block is still in L1 when this runs
+void gemm_epilogue_block(int32_t *c, unsigned ldc, unsigned mr, unsigned nr, unsigned n0, const gemm_opts_t *epi) {
+    const int32_t *bias = epi->bias ? (const int32_t *) &epi->bias[n0] : NULL;
+    int64_t lo = INT32_MIN, hi = INT32_MAX;
+    if (epi->act == GEMM_ACT_RELU) {
+        lo = 0;
+    } else if (epi->act == GEMM_ACT_CLAMP) {
+        lo = epi->act_lo.value;
+        hi = epi->act_hi.value;
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        int32_t *c_row = &c[m_ * ldc];
+        for (unsigned n_ = 0; n_ < nr; n_++) {
+            int64_t v = (int64_t) c_row[n_] + (bias ? bias[n_] : 0);
+            c_row[n_] = (int32_t) (v < lo ? lo : (v > hi ? hi : v));
+        }
+    }
+}
+
+void gemm_epilogue(nn_token_t* mat_c, unsigned dim_m, unsigned dim_n, const gemm_opts_t *opts) {
+    if (gemm_opts_has_epilogue(opts)) gemm_epilogue_block((int32_t *) mat_c, dim_n, dim_m, dim_n, 0, opts);
+}
+
+// Walks C[m0:m1, n0:n1] in GEMM_MR x GEMM_NR register blocks; each block accumulates over
+// the full k dimension in the selected microkernel, so C is written exactly once.
+// -- n0 must be a multiple of GEMM_NR when packed panels are used
+void gemm_block(gemm_ukernel_t ukernel, const int32_t *a, const int32_t *b, const int32_t *packed, int32_t *c,
+                unsigned dim_n, unsigned dim_k, unsigned m0, unsigned m1, unsigned n0, unsigned n1, const gemm_opts_t *epi) {
+    // Keep a GEMM_NR-wide column panel of B hot while sweeping down the rows of A
+    for (unsigned n = n0; n < n1; n += GEMM_NR) {
+        unsigned nr = (n + GEMM_NR < n1) ? GEMM_NR : n1 - n;
+        if (packed) {
+            // Panels are contiguous and zero-padded, so partial panels can still run the full
+            // width kernel into a scratch tile
+            const int32_t *panel = &packed[n * dim_k];
+            for (unsigned m = m0; m < m1; m += GEMM_MR) {
+                unsigned mr = (m + GEMM_MR < m1) ? GEMM_MR : m1 - m;
+                if (nr == GEMM_NR) {
+                    ukernel(&a[m * dim_k], dim_k, panel, GEMM_NR, &c[m * dim_n + n], dim_n, dim_k, mr, GEMM_NR);
+                } else {
+                    int32_t tile[GEMM_MR * GEMM_NR];
+                    ukernel(&a[m * dim_k], dim_k, panel, GEMM_NR, tile, GEMM_NR, dim_k, mr, GEMM_NR);
+                    for (unsigned m_ = 0; m_ < mr; m_++)
+                        for (unsigned n_ = 0; n_ < nr; n_++) c[(m + m_) * dim_n + n + n_] = tile[m_ * GEMM_NR + n_];
                 }
+                if (epi) gemm_epilogue_block(&c[m * dim_n + n], dim_n, mr, nr, n, epi);
             }
+        } else {
+            for (unsigned m = m0; m < m1; m += GEMM_MR) {
+                unsigned mr = (m + GEMM_MR < m1) ? GEMM_MR : m1 - m;
+                ukernel(&a[m * dim_k], dim_k, &b[n], dim_n, &c[m * dim_n + n], dim_n, dim_k, mr, nr);
+                if (epi) gemm_epilogue_block(&c[m * dim_n + n], dim_n, mr, nr, n, epi);
+            }
+        }
+    }
+}
+
+// Same walk as gemm_block() for quantized weights, which are read in place (k x n, row-major)
+void gemm_qblock(const gemm_opts_t *opts, const int32_t *a, const void *b, int32_t *c,
+                 unsigned dim_n, unsigned dim_k, unsigned m0, unsigned m1, unsigned n0, unsigned n1, const gemm_opts_t *epi) {
+    const gemm_kernel_ops_t *ops = gemm_get_kernel();
+    gemm_qukernel_t qukernel = (opts->prec == GEMM_PREC_Q8) ? ops->q8 : ops->q16;
+    unsigned elem_size = (opts->prec == GEMM_PREC_Q8) ? sizeof(nn_token_q8_t) : sizeof(nn_token_q16_t);
+    for (unsigned n = n0; n < n1; n += GEMM_NR) {
+        unsigned nr = (n + GEMM_NR < n1) ? GEMM_NR : n1 - n;
+        const void *b_panel = (const char *) b + n * elem_size;
+        for (unsigned m = m0; m < m1; m += GEMM_MR) {
+            unsigned mr = (m + GEMM_MR < m1) ? GEMM_MR : m1 - m;
+            qukernel(&a[m * dim_k], dim_k, b_panel, dim_n, &c[m * dim_n + n], dim_n, dim_k, mr, nr, opts->q_scale, opts->q_zero);
+            if (epi) gemm_epilogue_block(&c[m * dim_n + n], dim_n, mr, nr, n, epi);
+        }
+    }
+}
+
+// Output layers and classifier heads (n == 1) and single-row inputs (m == 1) go to the GEMV
+// kernels instead of the register-blocked path
+static bool gemm_try_gemv(const int32_t *a, const int32_t *b, const int32_t *packed, int32_t *c,
+                          unsigned dim_m, unsigned dim_n, unsigned dim_k, const gemm_opts_t *opts) {
+    const gemm_kernel_ops_t *ops = gemm_get_kernel();
+    bool wide = gemm_opts_wide(opts);
+    if (dim_n == 1 && !packed) {
+        (wide ? ops->mv_wide : ops->mv_narrow)(a, dim_k, b, c, dim_m, dim_k);
+        return true;
+    }
+    if (dim_m == 1) {
+        gemm_vm_t vm = wide ? ops->vm_wide : ops->vm_narrow;
+        if (!packed) {
+            vm(a, b, dim_n, c, dim_n, dim_k);
+        } else {
+            for (unsigned n = 0; n < dim_n; n += GEMM_NR)
+                vm(a, &packed[n * dim_k], GEMM_NR, &c[n], (n + GEMM_NR < dim_n) ? GEMM_NR : dim_n - n, dim_k);
+        }
+        return true;
+    }
+    return false;
+}
+
+// Walk C in tuned tiles (the whole matrix when tune is NULL) in the tuned loop order
+static void gemm_tiled(const gemm_opts_t *opts, const int32_t *a, const void *b, const int32_t *packed, int32_t *c,
+                       unsigned dim_m, unsigned dim_n, unsigned dim_k, const gemm_opts_t *epi, const gemm_tune_t *tune) {
+    bool quant = opts && opts->prec != GEMM_PREC_Q32;
+    gemm_ukernel_t ukernel = quant ? NULL : gemm_select_ukernel(opts);
+    unsigned tile_m = (tune && tune->tile_m) ? tune->tile_m : dim_m;
+    unsigned tile_n = (tune && tune->tile_n) ? tune->tile_n : dim_n;
+    bool m_outer = tune && tune->order == GEMM_ORDER_M_OUTER;
+    unsigned outer_len = m_outer ? dim_m : dim_n, outer_step = m_outer ? tile_m : tile_n;
+    unsigned inner_len = m_outer ? dim_n : dim_m, inner_step = m_outer ? tile_n : tile_m;
+    for (unsigned o = 0; o < outer_len; o += outer_step) {
+        for (unsigned i = 0; i < inner_len; i += inner_step) {
+            unsigned m0 = m_outer ? o : i, n0 = m_outer ? i : o;
+            unsigned m1 = (m0 + tile_m < dim_m) ? m0 + tile_m : dim_m;
+            unsigned n1 = (n0 + tile_n < dim_n) ? n0 + tile_n : dim_n;
+            if (quant) {
+                gemm_qblock(opts, a, b, c, dim_n, dim_k, m0, m1, n0, n1, epi);
+            } else {
+                gemm_block(ukernel, a, (const int32_t *) b, packed, c, dim_n, dim_k, m0, m1, n0, n1, epi);
+            }
+        }
+    }
+}
+
+void gemm_ex(const nn_token_t* mat_a, const nn_token_t* mat_b, nn_token_t* mat_c, unsigned dim_m, unsigned dim_n, unsigned dim_k, const gemm_opts_t *opts) {
+    // Without options (plain gemm() calls) the shape is looked up here; layers resolve it once
+    gemm_opts_t defaults;
+    if (!opts) {
+        gemm_opts_default(&defaults, gemm_tune_lookup(dim_m, dim_n, dim_k));
+        opts = &defaults;
+    }
+    const int32_t *packed = opts->packed_b ? (const int32_t *) opts->packed_b : NULL;
+    const gemm_opts_t *epi = gemm_opts_has_epilogue(opts) ? opts : NULL;
+    // A tuned tiling or loop order replaces the built-in GEMV/fixed-shape choice for this shape
+    const gemm_tune_t *tune = opts->tune;
+    if (opts->prec != GEMM_PREC_Q32 || (tune && (tune->tile_m || tune->tile_n || tune->order != GEMM_ORDER_N_OUTER))) {
+        gemm_tiled(opts, (const int32_t *) mat_a, mat_b, packed, (int32_t *) mat_c, dim_m, dim_n, dim_k, epi, tune);
+        return;
+    }
+    // The GEMV output is a single vector, so the epilogue runs right after it
+    if (gemm_try_gemv((const int32_t *) mat_a, (const int32_t *) mat_b, packed, (int32_t *) mat_c, dim_m, dim_n, dim_k, opts)) {
+        gemm_epilogue(mat_c, dim_m, dim_n, epi);
+        return;
+    }
+    // Square 16/32/48/64 layers have fully specialized kernels; layers with an epilogue take
+    // the generic walk, which fuses it per register block
+    int fixed = gemm_fixed_index(dim_m, dim_n, dim_k);
+    if (fixed >= 0 && !epi) {
+        const gemm_kernel_ops_t *ops = gemm_get_kernel();
+        (gemm_opts_wide(opts) ? ops->fixed_wide : ops->fixed_narrow)[fixed]((const int32_t *) mat_a, (const int32_t *) mat_b, packed, (int32_t *) mat_c);
+        return;
+    }
+    gemm_block(gemm_select_ukernel(opts), (const int32_t *) mat_a, (const int32_t *) mat_b, packed, (int32_t *) mat_c,
+               dim_n, dim_k, 0, dim_m, 0, dim_n, epi);
+}
+
+// Panel-outer, request-inner: each GEMM_NR-wide panel of B is loaded into cache once and
+// reused by every request of the batch before moving on to the next panel
+void gemm_batched(const nn_token_t* const* mat_a, const nn_token_t* mat_b, nn_token_t* const* mat_c, unsigned batch,
+                  unsigned dim_m, unsigned dim_n, unsigned dim_k, const gemm_opts_t *opts) {
+    bool quant = opts && opts->prec != GEMM_PREC_Q32;
+    if (!quant && (dim_m == 1 || dim_n == 1)) {
+        for (unsigned i = 0; i < batch; i++) gemm_ex(mat_a[i], mat_b, mat_c[i], dim_m, dim_n, dim_k, opts);
+        return;
+    }
+    gemm_ukernel_t ukernel = gemm_select_ukernel(opts);
+    const int32_t *packed = (opts && opts->packed_b) ? (const int32_t *) opts->packed_b : NULL;
+    const gemm_opts_t *epi = gemm_opts_has_epilogue(opts) ? opts : NULL;
+    for (unsigned n = 0; n < dim_n; n += GEMM_NR) {
+        unsigned n_end = (n + GEMM_NR < dim_n) ? n + GEMM_NR : dim_n;
+        for (unsigned i = 0; i < batch; i++) {
+            if (quant) {
+                gemm_qblock(opts, (const int32_t *) mat_a[i], mat_b, (int32_t *) mat_c[i], dim_n, dim_k, 0, dim_m, n, n_end, epi);
+                continue;
+            }
+            gemm_block(ukernel, (const int32_t *) mat_a[i], (const int32_t *) mat_b, packed, (int32_t *) mat_c[i],
+                       dim_n, dim_k, 0, dim_m, n, n_end, epi);
+        }
+    }
+}
+
+// Size in words of B packed by gemm_pack_b; the last panel is padded to GEMM_NR columns
+unsigned gemm_packed_size(unsigned dim_n, unsigned dim_k) {
+    return ((dim_n + GEMM_NR - 1) / GEMM_NR) * GEMM_NR * dim_k;
+}
+
+// Panel p holds columns [p * GEMM_NR, (p + 1) * GEMM_NR) of B as dim_k contiguous rows
+void gemm_pack_b(const nn_token_t* mat_b, nn_token_t* packed, unsigned dim_n, unsigned dim_k) {
+    for (unsigned n = 0; n < dim_n; n += GEMM_NR) {
+        unsigned nr = (n + GEMM_NR < dim_n) ? GEMM_NR : dim_n - n;
+        for (unsigned k = 0; k < dim_k; k++) {
+            for (unsigned n_ = 0; n_ < GEMM_NR; n_++) {
+                *packed++ = (n_ < nr) ? mat_b[k * dim_n + n + n_] : nn_token_zero();
+            }
+        }
+    }
+}
+
+unsigned gemm_quant_size(unsigned prec, unsigned count) {
+    switch (prec) {
+        case GEMM_PREC_Q16: return (count * sizeof(nn_token_q16_t) + sizeof(nn_token_t) - 1) / sizeof(nn_token_t);
+        case GEMM_PREC_Q8: return (count * sizeof(nn_token_q8_t) + sizeof(nn_token_t) - 1) / sizeof(nn_token_t);
+        default: return count;
+    }
+}
+
+// Asymmetric min/max quantization over the whole layer; the range always contains 0.0 so
+// that it maps to an exact quantized value
+void gemm_quantize_b(const nn_token_t* mat_b, void* quant, unsigned prec, unsigned count, int32_t *scale, int32_t *zero_point) {
+    int32_t qmin = (prec == GEMM_PREC_Q8) ? INT8_MIN : INT16_MIN;
+    int32_t qmax = (prec == GEMM_PREC_Q8) ? INT8_MAX : INT16_MAX;
+    int64_t lo = 0, hi = 0;
+    for (unsigned i = 0; i < count; i++) {
+        if (mat_b[i].value < lo) lo = mat_b[i].value;
+        if (mat_b[i].value > hi) hi = mat_b[i].value;
+    }
+    int64_t step = (hi - lo + (qmax - qmin) - 1) / (qmax - qmin);
+    if (step < 1) step = 1;
+    *scale = (int32_t) step;
+    *zero_point = qmin + (int32_t) ((-lo + step / 2) / step);
+    if (*zero_point > qmax) *zero_point = qmax;
+    for (unsigned i = 0; i < count; i++) {
+        if (prec == GEMM_PREC_Q8) {
+            ((nn_token_q8_t *) quant)[i] = nn_token_to_q8(mat_b[i], *scale, *zero_point);
+        } else {
+            ((nn_token_q16_t *) quant)[i] = nn_token_to_q16(mat_b[i], *scale, *zero_point);
         }
     }
 }
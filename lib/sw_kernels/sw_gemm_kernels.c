@@ -0,0 +1,895 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <common_defines.h>
+#include <nn_token.h>
+#include <sw_gemm_kernels.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+#include <riscv_vector.h>
+#endif
+
+// Fixed-shape kernels: every size is a multiple of the register block, so the microkernel
+// is called with constant strides, k and full tiles, and flatten inlines it into the loop
+#define GEMM_FIXED_LOOP(kern, S, b_panel, ldb) \
+    for (unsigned n = 0; n < S; n += GEMM_NR) \
+        for (unsigned m = 0; m < S; m += GEMM_MR) \
+            kern(&a[m * S], S, &b_panel, ldb, &c[m * S + n], S, S, GEMM_MR, GEMM_NR);
+
+#define GEMM_DEFINE_FIXED(attr, name, kern, S) \
+    attr __attribute__((flatten)) \
+    static void name##_##S(const int32_t *a, const int32_t *b, const int32_t *packed, int32_t *c) { \
+        if (packed) { GEMM_FIXED_LOOP(kern, S, packed[n * S], GEMM_NR) } \
+        else { GEMM_FIXED_LOOP(kern, S, b[n], S) } \
+    }
+
+#define GEMM_DEFINE_FIXED_ALL(attr, name, kern) \
+    GEMM_DEFINE_FIXED(attr, name, kern, 16) \
+    GEMM_DEFINE_FIXED(attr, name, kern, 32) \
+    GEMM_DEFINE_FIXED(attr, name, kern, 48) \
+    GEMM_DEFINE_FIXED(attr, name, kern, 64)
+
+#define GEMM_FIXED_TABLE(name) { name##_16, name##_32, name##_48, name##_64 }
+
+_Static_assert(GEMM_FIXED_COUNT == 4 && GEMM_FIXED_STEP % GEMM_NR == 0 && GEMM_FIXED_STEP % GEMM_MR == 0,
+               "fixed-shape kernels are generated for 16/32/48/64");
+
+// Scalar quantized microkernels, one per storage type; also handle the partial tiles for the vector kernels
+#define GEMM_DEFINE_QUANT_SCALAR(name, qtype) \
+    static void name(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc, \
+                     unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero) { \
+        const qtype *bq = (const qtype *) b; \
+        int64_t acc[GEMM_MR][GEMM_NR] = {{0}}; \
+        for (unsigned k_ = 0; k_ < k; k_++) { \
+            const qtype *b_row = &bq[k_ * ldb]; \
+            for (unsigned m_ = 0; m_ < mr; m_++) { \
+                int64_t a_val = a[m_ * lda + k_]; \
+                for (unsigned n_ = 0; n_ < nr; n_++) acc[m_][n_] += a_val * (b_row[n_] - zero); \
+            } \
+        } \
+        for (unsigned m_ = 0; m_ < mr; m_++) \
+            for (unsigned n_ = 0; n_ < nr; n_++) c[m_ * ldc + n_] = nn_token_from_qacc(acc[m_][n_], scale).value; \
+    }
+
+GEMM_DEFINE_QUANT_SCALAR(gemm_qukernel_scalar_q16, int16_t)
+GEMM_DEFINE_QUANT_SCALAR(gemm_qukernel_scalar_q8, int8_t)
+
+// Scalar microkernel; also handles the partial tiles for all vector kernels
+static void gemm_ukernel_scalar(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    int32_t acc[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        const int32_t *b_row = &b[k_ * ldb];
+        for (unsigned m_ = 0; m_ < mr; m_++) {
+            int64_t a_val = a[m_ * lda + k_];
+            for (unsigned n_ = 0; n_ < nr; n_++) {
+                acc[m_][n_] += (int32_t) ((a_val * b_row[n_]) >> NN_FRACTIONAL_BITS);
+            }
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        for (unsigned n_ = 0; n_ < nr; n_++) {
+            c[m_ * ldc + n_] = acc[m_][n_];
+        }
+    }
+}
+
+// Scalar wide-accumulator microkernel; also handles the partial tiles for all vector kernels
+static void gemm_ukernel_scalar_wide(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                     int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    int64_t acc[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        const int32_t *b_row = &b[k_ * ldb];
+        for (unsigned m_ = 0; m_ < mr; m_++) {
+            int64_t a_val = a[m_ * lda + k_];
+            for (unsigned n_ = 0; n_ < nr; n_++) {
+                acc[m_][n_] += a_val * b_row[n_];
+            }
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        for (unsigned n_ = 0; n_ < nr; n_++) {
+            c[m_ * ldc + n_] = nn_token_from_acc(acc[m_][n_]).value;
+        }
+    }
+}
+
+// Scalar GEMV kernels; the vector versions use them for leftover rows/columns
+static void gemm_mv_scalar(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        int32_t acc = 0;
+        for (unsigned k_ = 0; k_ < k; k_++) acc += (int32_t) (((int64_t) a[m_ * lda + k_] * x[k_]) >> NN_FRACTIONAL_BITS);
+        y[m_] = acc;
+    }
+}
+
+static void gemm_mv_scalar_wide(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        int64_t acc = 0;
+        for (unsigned k_ = 0; k_ < k; k_++) acc += (int64_t) a[m_ * lda + k_] * x[k_];
+        y[m_] = nn_token_from_acc(acc).value;
+    }
+}
+
+// A single-row microkernel call only does the work for that row
+static void gemm_vm_scalar(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    for (unsigned n_ = 0; n_ < n; n_ += GEMM_NR)
+        gemm_ukernel_scalar(x, k, &b[n_], ldb, &y[n_], 0, k, 1, (n_ + GEMM_NR < n) ? GEMM_NR : n - n_);
+}
+
+static void gemm_vm_scalar_wide(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    for (unsigned n_ = 0; n_ < n; n_ += GEMM_NR)
+        gemm_ukernel_scalar_wide(x, k, &b[n_], ldb, &y[n_], 0, k, 1, (n_ + GEMM_NR < n) ? GEMM_NR : n - n_);
+}
+
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_scalar, gemm_ukernel_scalar)
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_scalar_wide, gemm_ukernel_scalar_wide)
+
+static const gemm_kernel_ops_t gemm_kernel_scalar = {
+    .name = "scalar",
+    .narrow = gemm_ukernel_scalar,
+    .wide = gemm_ukernel_scalar_wide,
+    .mv_narrow = gemm_mv_scalar,
+    .mv_wide = gemm_mv_scalar_wide,
+    .vm_narrow = gemm_vm_scalar,
+    .vm_wide = gemm_vm_scalar_wide,
+    .fixed_narrow = GEMM_FIXED_TABLE(gemm_fixed_scalar),
+    .fixed_wide = GEMM_FIXED_TABLE(gemm_fixed_scalar_wide),
+    .q16 = gemm_qukernel_scalar_q16,
+    .q8 = gemm_qukernel_scalar_q8,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+// 16.16 multiply of a broadcast value with 8 lanes: the even and odd lanes are widened
+// separately and bits [16:47] of each 64-bit product are merged back into 32-bit lanes.
+__attribute__((target("avx2")))
+static inline __m256i gemm_mul_avx2(__m256i a, __m256i b, __m256i b_odd) {
+    __m256i prod_even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), NN_FRACTIONAL_BITS);
+    __m256i prod_odd = _mm256_slli_epi64(_mm256_mul_epi32(a, b_odd), 32 - NN_FRACTIONAL_BITS);
+    return _mm256_blend_epi32(prod_even, prod_odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+static void gemm_ukernel_avx2(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                              int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    // Rows beyond mr recompute row 0 so that the accumulators stay in registers
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    __m256i acc[GEMM_MR][2];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) acc[m_][0] = acc[m_][1] = _mm256_setzero_si256();
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m256i b_lo = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb]);
+        __m256i b_hi = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb + 8]);
+        __m256i b_lo_odd = _mm256_srli_epi64(b_lo, 32);
+        __m256i b_hi_odd = _mm256_srli_epi64(b_hi, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m256i a_val = _mm256_set1_epi32(a_row[m_][k_]);
+            acc[m_][0] = _mm256_add_epi32(acc[m_][0], gemm_mul_avx2(a_val, b_lo, b_lo_odd));
+            acc[m_][1] = _mm256_add_epi32(acc[m_][1], gemm_mul_avx2(a_val, b_hi, b_hi_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        _mm256_storeu_si256((__m256i *) &c[m_ * ldc], acc[m_][0]);
+        _mm256_storeu_si256((__m256i *) &c[m_ * ldc + 8], acc[m_][1]);
+    }
+}
+
+// Wide accumulation keeps the even and odd lanes in separate 64-bit accumulators
+__attribute__((target("avx2")))
+static void gemm_ukernel_avx2_wide(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                   int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar_wide(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    // acc[m][v]: v = 0/1 even/odd lanes of columns 0-7, v = 2/3 even/odd lanes of columns 8-15
+    __m256i acc[GEMM_MR][4];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++)
+        for (unsigned v = 0; v < 4; v++) acc[m_][v] = _mm256_setzero_si256();
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m256i b_lo = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb]);
+        __m256i b_hi = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb + 8]);
+        __m256i b_lo_odd = _mm256_srli_epi64(b_lo, 32);
+        __m256i b_hi_odd = _mm256_srli_epi64(b_hi, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m256i a_val = _mm256_set1_epi32(a_row[m_][k_]);
+            acc[m_][0] = _mm256_add_epi64(acc[m_][0], _mm256_mul_epi32(a_val, b_lo));
+            acc[m_][1] = _mm256_add_epi64(acc[m_][1], _mm256_mul_epi32(a_val, b_lo_odd));
+            acc[m_][2] = _mm256_add_epi64(acc[m_][2], _mm256_mul_epi32(a_val, b_hi));
+            acc[m_][3] = _mm256_add_epi64(acc[m_][3], _mm256_mul_epi32(a_val, b_hi_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        int64_t sums[4][4];
+        for (unsigned v = 0; v < 4; v++) _mm256_storeu_si256((__m256i *) sums[v], acc[m_][v]);
+        for (unsigned j = 0; j < 4; j++) {
+            c[m_ * ldc + 2 * j] = nn_token_from_acc(sums[0][j]).value;
+            c[m_ * ldc + 2 * j + 1] = nn_token_from_acc(sums[1][j]).value;
+            c[m_ * ldc + 8 + 2 * j] = nn_token_from_acc(sums[2][j]).value;
+            c[m_ * ldc + 8 + 2 * j + 1] = nn_token_from_acc(sums[3][j]).value;
+        }
+    }
+}
+
+// Element-wise 16.16 multiply of 8 lanes
+__attribute__((target("avx2")))
+static inline __m256i gemm_mul_vv_avx2(__m256i a, __m256i b) {
+    __m256i prod_even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), NN_FRACTIONAL_BITS);
+    __m256i prod_odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    return _mm256_blend_epi32(prod_even, _mm256_slli_epi64(prod_odd, 32 - NN_FRACTIONAL_BITS), 0xAA);
+}
+
+__attribute__((target("avx2")))
+static void gemm_mv_avx2(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~7u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        __m256i acc = _mm256_setzero_si256();
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 8) {
+            __m256i a_val = _mm256_loadu_si256((const __m256i *) &a_row[k_]);
+            __m256i x_val = _mm256_loadu_si256((const __m256i *) &x[k_]);
+            acc = _mm256_add_epi32(acc, gemm_mul_vv_avx2(a_val, x_val));
+        }
+        int32_t lanes[8];
+        _mm256_storeu_si256((__m256i *) lanes, acc);
+        uint32_t sum = 0; // Wrapping sum, like the 32-bit lanes
+        for (unsigned j = 0; j < 8; j++) sum += (uint32_t) lanes[j];
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (uint32_t) (int32_t) (((int64_t) a_row[k_] * x[k_]) >> NN_FRACTIONAL_BITS);
+        y[m_] = (int32_t) sum;
+    }
+}
+
+__attribute__((target("avx2")))
+static void gemm_mv_avx2_wide(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~7u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        __m256i acc_even = _mm256_setzero_si256(), acc_odd = _mm256_setzero_si256();
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 8) {
+            __m256i a_val = _mm256_loadu_si256((const __m256i *) &a_row[k_]);
+            __m256i x_val = _mm256_loadu_si256((const __m256i *) &x[k_]);
+            acc_even = _mm256_add_epi64(acc_even, _mm256_mul_epi32(a_val, x_val));
+            acc_odd = _mm256_add_epi64(acc_odd, _mm256_mul_epi32(_mm256_srli_epi64(a_val, 32), _mm256_srli_epi64(x_val, 32)));
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc_even, acc_odd));
+        int64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (int64_t) a_row[k_] * x[k_];
+        y[m_] = nn_token_from_acc(sum).value;
+    }
+}
+
+// One row of the microkernel, without recomputing the unused rows
+__attribute__((target("avx2")))
+static void gemm_vm_avx2(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~(GEMM_NR - 1);
+    for (unsigned n_ = 0; n_ < n_vec; n_ += GEMM_NR) {
+        __m256i acc_lo = _mm256_setzero_si256(), acc_hi = _mm256_setzero_si256();
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            __m256i b_lo = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb + n_]);
+            __m256i b_hi = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb + n_ + 8]);
+            __m256i x_val = _mm256_set1_epi32(x[k_]);
+            acc_lo = _mm256_add_epi32(acc_lo, gemm_mul_avx2(x_val, b_lo, _mm256_srli_epi64(b_lo, 32)));
+            acc_hi = _mm256_add_epi32(acc_hi, gemm_mul_avx2(x_val, b_hi, _mm256_srli_epi64(b_hi, 32)));
+        }
+        _mm256_storeu_si256((__m256i *) &y[n_], acc_lo);
+        _mm256_storeu_si256((__m256i *) &y[n_ + 8], acc_hi);
+    }
+    if (n_vec < n) gemm_vm_scalar(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+__attribute__((target("avx2")))
+static void gemm_vm_avx2_wide(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~7u;
+    for (unsigned n_ = 0; n_ < n_vec; n_ += 8) {
+        __m256i acc_even = _mm256_setzero_si256(), acc_odd = _mm256_setzero_si256();
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            __m256i b_row = _mm256_loadu_si256((const __m256i *) &b[k_ * ldb + n_]);
+            __m256i x_val = _mm256_set1_epi32(x[k_]);
+            acc_even = _mm256_add_epi64(acc_even, _mm256_mul_epi32(x_val, b_row));
+            acc_odd = _mm256_add_epi64(acc_odd, _mm256_mul_epi32(x_val, _mm256_srli_epi64(b_row, 32)));
+        }
+        int64_t sums[2][4];
+        _mm256_storeu_si256((__m256i *) sums[0], acc_even);
+        _mm256_storeu_si256((__m256i *) sums[1], acc_odd);
+        for (unsigned j = 0; j < 4; j++) {
+            y[n_ + 2 * j] = nn_token_from_acc(sums[0][j]).value;
+            y[n_ + 2 * j + 1] = nn_token_from_acc(sums[1][j]).value;
+        }
+    }
+    if (n_vec < n) gemm_vm_scalar_wide(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+// Quantized weights are widened to 32-bit lanes and shifted by the zero point, then accumulated
+// like the wide kernel
+__attribute__((target("avx2"), always_inline))
+static inline void gemm_qukernel_avx2(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                      unsigned k, unsigned mr, int32_t scale, int32_t zero, bool q8) {
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    __m256i acc[GEMM_MR][4];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++)
+        for (unsigned v = 0; v < 4; v++) acc[m_][v] = _mm256_setzero_si256();
+    __m256i zero_v = _mm256_set1_epi32(zero);
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m256i b_lo, b_hi;
+        if (q8) {
+            __m128i row = _mm_loadu_si128((const __m128i *) &((const int8_t *) b)[k_ * ldb]);
+            b_lo = _mm256_cvtepi8_epi32(row);
+            b_hi = _mm256_cvtepi8_epi32(_mm_srli_si128(row, 8));
+        } else {
+            const int16_t *row = &((const int16_t *) b)[k_ * ldb];
+            b_lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) row));
+            b_hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &row[8]));
+        }
+        b_lo = _mm256_sub_epi32(b_lo, zero_v);
+        b_hi = _mm256_sub_epi32(b_hi, zero_v);
+        __m256i b_lo_odd = _mm256_srli_epi64(b_lo, 32);
+        __m256i b_hi_odd = _mm256_srli_epi64(b_hi, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m256i a_val = _mm256_set1_epi32(a_row[m_][k_]);
+            acc[m_][0] = _mm256_add_epi64(acc[m_][0], _mm256_mul_epi32(a_val, b_lo));
+            acc[m_][1] = _mm256_add_epi64(acc[m_][1], _mm256_mul_epi32(a_val, b_lo_odd));
+            acc[m_][2] = _mm256_add_epi64(acc[m_][2], _mm256_mul_epi32(a_val, b_hi));
+            acc[m_][3] = _mm256_add_epi64(acc[m_][3], _mm256_mul_epi32(a_val, b_hi_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        int64_t sums[4][4];
+        for (unsigned v = 0; v < 4; v++) _mm256_storeu_si256((__m256i *) sums[v], acc[m_][v]);
+        for (unsigned j = 0; j < 4; j++) {
+            c[m_ * ldc + 2 * j] = nn_token_from_qacc(sums[0][j], scale).value;
+            c[m_ * ldc + 2 * j + 1] = nn_token_from_qacc(sums[1][j], scale).value;
+            c[m_ * ldc + 8 + 2 * j] = nn_token_from_qacc(sums[2][j], scale).value;
+            c[m_ * ldc + 8 + 2 * j + 1] = nn_token_from_qacc(sums[3][j], scale).value;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void gemm_qukernel_avx2_q16(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                   unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero) {
+    if (nr != GEMM_NR) { gemm_qukernel_scalar_q16(a, lda, b, ldb, c, ldc, k, mr, nr, scale, zero); return; }
+    gemm_qukernel_avx2(a, lda, b, ldb, c, ldc, k, mr, scale, zero, false);
+}
+
+__attribute__((target("avx2")))
+static void gemm_qukernel_avx2_q8(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                  unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero) {
+    if (nr != GEMM_NR) { gemm_qukernel_scalar_q8(a, lda, b, ldb, c, ldc, k, mr, nr, scale, zero); return; }
+    gemm_qukernel_avx2(a, lda, b, ldb, c, ldc, k, mr, scale, zero, true);
+}
+
+GEMM_DEFINE_FIXED_ALL(__attribute__((target("avx2"))), gemm_fixed_avx2, gemm_ukernel_avx2)
+GEMM_DEFINE_FIXED_ALL(__attribute__((target("avx2"))), gemm_fixed_avx2_wide, gemm_ukernel_avx2_wide)
+
+static const gemm_kernel_ops_t gemm_kernel_avx2 = {
+    .name = "avx2",
+    .narrow = gemm_ukernel_avx2,
+    .wide = gemm_ukernel_avx2_wide,
+    .mv_narrow = gemm_mv_avx2,
+    .mv_wide = gemm_mv_avx2_wide,
+    .vm_narrow = gemm_vm_avx2,
+    .vm_wide = gemm_vm_avx2_wide,
+    .fixed_narrow = GEMM_FIXED_TABLE(gemm_fixed_avx2),
+    .fixed_wide = GEMM_FIXED_TABLE(gemm_fixed_avx2_wide),
+    .q16 = gemm_qukernel_avx2_q16,
+    .q8 = gemm_qukernel_avx2_q8,
+};
+
+__attribute__((target("avx512f")))
+static inline __m512i gemm_mul_avx512(__m512i a, __m512i b, __m512i b_odd) {
+    __m512i prod_even = _mm512_srli_epi64(_mm512_mul_epi32(a, b), NN_FRACTIONAL_BITS);
+    __m512i prod_odd = _mm512_slli_epi64(_mm512_mul_epi32(a, b_odd), 32 - NN_FRACTIONAL_BITS);
+    return _mm512_mask_blend_epi32(0xAAAA, prod_even, prod_odd);
+}
+
+// Round, shift and saturate 8 sums at a time, then interleave even and odd columns
+__attribute__((target("avx512f")))
+static inline void gemm_store_wide_avx512(int32_t *c, __m512i acc_even, __m512i acc_odd) {
+    const __m512i half = _mm512_set1_epi64(1LL << (NN_FRACTIONAL_BITS - 1));
+    __m256i even = _mm512_cvtsepi64_epi32(_mm512_srai_epi64(_mm512_add_epi64(acc_even, half), NN_FRACTIONAL_BITS));
+    __m256i odd = _mm512_cvtsepi64_epi32(_mm512_srai_epi64(_mm512_add_epi64(acc_odd, half), NN_FRACTIONAL_BITS));
+    __m512i row = _mm512_permutex2var_epi32(_mm512_castsi256_si512(even),
+        _mm512_set_epi32(23, 7, 22, 6, 21, 5, 20, 4, 19, 3, 18, 2, 17, 1, 16, 0), _mm512_castsi256_si512(odd));
+    _mm512_storeu_si512((void *) c, row);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_ukernel_avx512(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    __m512i acc[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) acc[m_] = _mm512_setzero_si512();
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m512i b_row = _mm512_loadu_si512((const void *) &b[k_ * ldb]);
+        __m512i b_odd = _mm512_srli_epi64(b_row, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m512i a_val = _mm512_set1_epi32(a_row[m_][k_]);
+            acc[m_] = _mm512_add_epi32(acc[m_], gemm_mul_avx512(a_val, b_row, b_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        _mm512_storeu_si512((void *) &c[m_ * ldc], acc[m_]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_ukernel_avx512_wide(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                     int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar_wide(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    __m512i acc_even[GEMM_MR], acc_odd[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) acc_even[m_] = acc_odd[m_] = _mm512_setzero_si512();
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m512i b_row = _mm512_loadu_si512((const void *) &b[k_ * ldb]);
+        __m512i b_odd = _mm512_srli_epi64(b_row, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m512i a_val = _mm512_set1_epi32(a_row[m_][k_]);
+            acc_even[m_] = _mm512_add_epi64(acc_even[m_], _mm512_mul_epi32(a_val, b_row));
+            acc_odd[m_] = _mm512_add_epi64(acc_odd[m_], _mm512_mul_epi32(a_val, b_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) gemm_store_wide_avx512(&c[m_ * ldc], acc_even[m_], acc_odd[m_]);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_mv_avx512(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~15u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        __m512i acc = _mm512_setzero_si512();
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 16) {
+            __m512i a_val = _mm512_loadu_si512((const void *) &a_row[k_]);
+            __m512i x_val = _mm512_loadu_si512((const void *) &x[k_]);
+            __m512i prod_even = _mm512_srli_epi64(_mm512_mul_epi32(a_val, x_val), NN_FRACTIONAL_BITS);
+            __m512i prod_odd = _mm512_mul_epi32(_mm512_srli_epi64(a_val, 32), _mm512_srli_epi64(x_val, 32));
+            acc = _mm512_add_epi32(acc, _mm512_mask_blend_epi32(0xAAAA, prod_even, _mm512_slli_epi64(prod_odd, 32 - NN_FRACTIONAL_BITS)));
+        }
+        uint32_t sum = (uint32_t) _mm512_reduce_add_epi32(acc);
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (uint32_t) (int32_t) (((int64_t) a_row[k_] * x[k_]) >> NN_FRACTIONAL_BITS);
+        y[m_] = (int32_t) sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_mv_avx512_wide(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~15u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        __m512i acc = _mm512_setzero_si512();
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 16) {
+            __m512i a_val = _mm512_loadu_si512((const void *) &a_row[k_]);
+            __m512i x_val = _mm512_loadu_si512((const void *) &x[k_]);
+            acc = _mm512_add_epi64(acc, _mm512_mul_epi32(a_val, x_val));
+            acc = _mm512_add_epi64(acc, _mm512_mul_epi32(_mm512_srli_epi64(a_val, 32), _mm512_srli_epi64(x_val, 32)));
+        }
+        int64_t sum = _mm512_reduce_add_epi64(acc);
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (int64_t) a_row[k_] * x[k_];
+        y[m_] = nn_token_from_acc(sum).value;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_vm_avx512(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~15u;
+    for (unsigned n_ = 0; n_ < n_vec; n_ += 16) {
+        __m512i acc = _mm512_setzero_si512();
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            __m512i b_row = _mm512_loadu_si512((const void *) &b[k_ * ldb + n_]);
+            acc = _mm512_add_epi32(acc, gemm_mul_avx512(_mm512_set1_epi32(x[k_]), b_row, _mm512_srli_epi64(b_row, 32)));
+        }
+        _mm512_storeu_si512((void *) &y[n_], acc);
+    }
+    if (n_vec < n) gemm_vm_scalar(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_vm_avx512_wide(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~15u;
+    for (unsigned n_ = 0; n_ < n_vec; n_ += 16) {
+        __m512i acc_even = _mm512_setzero_si512(), acc_odd = _mm512_setzero_si512();
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            __m512i b_row = _mm512_loadu_si512((const void *) &b[k_ * ldb + n_]);
+            __m512i x_val = _mm512_set1_epi32(x[k_]);
+            acc_even = _mm512_add_epi64(acc_even, _mm512_mul_epi32(x_val, b_row));
+            acc_odd = _mm512_add_epi64(acc_odd, _mm512_mul_epi32(x_val, _mm512_srli_epi64(b_row, 32)));
+        }
+        gemm_store_wide_avx512(&y[n_], acc_even, acc_odd);
+    }
+    if (n_vec < n) gemm_vm_scalar_wide(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+// Quantized weights: one 16-column row is widened into a single vector
+__attribute__((target("avx512f"), always_inline))
+static inline void gemm_qukernel_avx512(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                        unsigned k, unsigned mr, int32_t scale, int32_t zero, bool q8) {
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    __m512i acc_even[GEMM_MR], acc_odd[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) acc_even[m_] = acc_odd[m_] = _mm512_setzero_si512();
+    __m512i zero_v = _mm512_set1_epi32(zero);
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        __m512i b_row = q8 ? _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *) &((const int8_t *) b)[k_ * ldb]))
+                           : _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *) &((const int16_t *) b)[k_ * ldb]));
+        b_row = _mm512_sub_epi32(b_row, zero_v);
+        __m512i b_odd = _mm512_srli_epi64(b_row, 32);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            __m512i a_val = _mm512_set1_epi32(a_row[m_][k_]);
+            acc_even[m_] = _mm512_add_epi64(acc_even[m_], _mm512_mul_epi32(a_val, b_row));
+            acc_odd[m_] = _mm512_add_epi64(acc_odd[m_], _mm512_mul_epi32(a_val, b_odd));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++) {
+        int64_t even[8], odd[8];
+        _mm512_storeu_si512((void *) even, acc_even[m_]);
+        _mm512_storeu_si512((void *) odd, acc_odd[m_]);
+        for (unsigned j = 0; j < 8; j++) {
+            c[m_ * ldc + 2 * j] = nn_token_from_qacc(even[j], scale).value;
+            c[m_ * ldc + 2 * j + 1] = nn_token_from_qacc(odd[j], scale).value;
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_qukernel_avx512_q16(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                     unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero) {
+    if (nr != GEMM_NR) { gemm_qukernel_scalar_q16(a, lda, b, ldb, c, ldc, k, mr, nr, scale, zero); return; }
+    gemm_qukernel_avx512(a, lda, b, ldb, c, ldc, k, mr, scale, zero, false);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_qukernel_avx512_q8(const int32_t *a, unsigned lda, const void *b, unsigned ldb, int32_t *c, unsigned ldc,
+                                    unsigned k, unsigned mr, unsigned nr, int32_t scale, int32_t zero) {
+    if (nr != GEMM_NR) { gemm_qukernel_scalar_q8(a, lda, b, ldb, c, ldc, k, mr, nr, scale, zero); return; }
+    gemm_qukernel_avx512(a, lda, b, ldb, c, ldc, k, mr, scale, zero, true);
+}
+
+GEMM_DEFINE_FIXED_ALL(__attribute__((target("avx512f"))), gemm_fixed_avx512, gemm_ukernel_avx512)
+GEMM_DEFINE_FIXED_ALL(__attribute__((target("avx512f"))), gemm_fixed_avx512_wide, gemm_ukernel_avx512_wide)
+
+static const gemm_kernel_ops_t gemm_kernel_avx512 = {
+    .name = "avx512",
+    .narrow = gemm_ukernel_avx512,
+    .wide = gemm_ukernel_avx512_wide,
+    .mv_narrow = gemm_mv_avx512,
+    .mv_wide = gemm_mv_avx512_wide,
+    .vm_narrow = gemm_vm_avx512,
+    .vm_wide = gemm_vm_avx512_wide,
+    .fixed_narrow = GEMM_FIXED_TABLE(gemm_fixed_avx512),
+    .fixed_wide = GEMM_FIXED_TABLE(gemm_fixed_avx512_wide),
+    .q16 = gemm_qukernel_avx512_q16,
+    .q8 = gemm_qukernel_avx512_q8,
+};
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+// 16.16 multiply of 4 lanes by a scalar: widen, then narrow with a 16-bit right shift
+static inline int32x4_t gemm_mul_neon(int32x4_t b, int32_t a) {
+    int64x2_t prod_lo = vmull_n_s32(vget_low_s32(b), a);
+    int64x2_t prod_hi = vmull_high_n_s32(b, a);
+    return vcombine_s32(vshrn_n_s64(prod_lo, NN_FRACTIONAL_BITS), vshrn_n_s64(prod_hi, NN_FRACTIONAL_BITS));
+}
+
+static void gemm_ukernel_neon(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                              int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    int32x4_t acc[GEMM_MR][4];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++)
+        for (unsigned v = 0; v < 4; v++) acc[m_][v] = vdupq_n_s32(0);
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        int32x4_t b_row[4];
+        for (unsigned v = 0; v < 4; v++) b_row[v] = vld1q_s32(&b[k_ * ldb + 4 * v]);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            int32_t a_val = a_row[m_][k_];
+            for (unsigned v = 0; v < 4; v++) acc[m_][v] = vaddq_s32(acc[m_][v], gemm_mul_neon(b_row[v], a_val));
+        }
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++)
+        for (unsigned v = 0; v < 4; v++) vst1q_s32(&c[m_ * ldc + 4 * v], acc[m_][v]);
+}
+
+// Wide accumulation uses the widening multiply-accumulate on pairs of columns
+static void gemm_ukernel_neon_wide(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                   int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    if (nr != GEMM_NR) { gemm_ukernel_scalar_wide(a, lda, b, ldb, c, ldc, k, mr, nr); return; }
+
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    int64x2_t acc[GEMM_MR][8];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++)
+        for (unsigned v = 0; v < 8; v++) acc[m_][v] = vdupq_n_s64(0);
+
+    for (unsigned k_ = 0; k_ < k; k_++) {
+        int32x4_t b_row[4];
+        for (unsigned v = 0; v < 4; v++) b_row[v] = vld1q_s32(&b[k_ * ldb + 4 * v]);
+        for (unsigned m_ = 0; m_ < GEMM_MR; m_++) {
+            int32_t a_val = a_row[m_][k_];
+            for (unsigned v = 0; v < 4; v++) {
+                acc[m_][2 * v] = vmlal_n_s32(acc[m_][2 * v], vget_low_s32(b_row[v]), a_val);
+                acc[m_][2 * v + 1] = vmlal_high_n_s32(acc[m_][2 * v + 1], b_row[v], a_val);
+            }
+        }
+    }
+    // Rounding, saturating narrow shift by the fractional bits
+    for (unsigned m_ = 0; m_ < mr; m_++)
+        for (unsigned v = 0; v < 8; v++) vst1_s32(&c[m_ * ldc + 2 * v], vqrshrn_n_s64(acc[m_][v], NN_FRACTIONAL_BITS));
+}
+
+static void gemm_mv_neon(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~3u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        int32x4_t acc = vdupq_n_s32(0);
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 4) {
+            int32x4_t a_val = vld1q_s32(&a_row[k_]);
+            int32x4_t x_val = vld1q_s32(&x[k_]);
+            int64x2_t prod_lo = vmull_s32(vget_low_s32(a_val), vget_low_s32(x_val));
+            int64x2_t prod_hi = vmull_high_s32(a_val, x_val);
+            acc = vaddq_s32(acc, vcombine_s32(vshrn_n_s64(prod_lo, NN_FRACTIONAL_BITS), vshrn_n_s64(prod_hi, NN_FRACTIONAL_BITS)));
+        }
+        uint32_t sum = (uint32_t) vaddvq_s32(acc);
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (uint32_t) (int32_t) (((int64_t) a_row[k_] * x[k_]) >> NN_FRACTIONAL_BITS);
+        y[m_] = (int32_t) sum;
+    }
+}
+
+static void gemm_mv_neon_wide(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    unsigned k_vec = k & ~3u;
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        int64x2_t acc_lo = vdupq_n_s64(0), acc_hi = vdupq_n_s64(0);
+        for (unsigned k_ = 0; k_ < k_vec; k_ += 4) {
+            int32x4_t a_val = vld1q_s32(&a_row[k_]);
+            int32x4_t x_val = vld1q_s32(&x[k_]);
+            acc_lo = vmlal_s32(acc_lo, vget_low_s32(a_val), vget_low_s32(x_val));
+            acc_hi = vmlal_high_s32(acc_hi, a_val, x_val);
+        }
+        int64_t sum = vaddvq_s64(vaddq_s64(acc_lo, acc_hi));
+        for (unsigned k_ = k_vec; k_ < k; k_++) sum += (int64_t) a_row[k_] * x[k_];
+        y[m_] = nn_token_from_acc(sum).value;
+    }
+}
+
+static void gemm_vm_neon(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~(GEMM_NR - 1);
+    for (unsigned n_ = 0; n_ < n_vec; n_ += GEMM_NR) {
+        int32x4_t acc[4];
+        for (unsigned v = 0; v < 4; v++) acc[v] = vdupq_n_s32(0);
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            for (unsigned v = 0; v < 4; v++) acc[v] = vaddq_s32(acc[v], gemm_mul_neon(vld1q_s32(&b[k_ * ldb + n_ + 4 * v]), x[k_]));
+        }
+        for (unsigned v = 0; v < 4; v++) vst1q_s32(&y[n_ + 4 * v], acc[v]);
+    }
+    if (n_vec < n) gemm_vm_scalar(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+static void gemm_vm_neon_wide(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    unsigned n_vec = n & ~(GEMM_NR - 1);
+    for (unsigned n_ = 0; n_ < n_vec; n_ += GEMM_NR) {
+        int64x2_t acc[8];
+        for (unsigned v = 0; v < 8; v++) acc[v] = vdupq_n_s64(0);
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            for (unsigned v = 0; v < 4; v++) {
+                int32x4_t b_row = vld1q_s32(&b[k_ * ldb + n_ + 4 * v]);
+                acc[2 * v] = vmlal_n_s32(acc[2 * v], vget_low_s32(b_row), x[k_]);
+                acc[2 * v + 1] = vmlal_high_n_s32(acc[2 * v + 1], b_row, x[k_]);
+            }
+        }
+        for (unsigned v = 0; v < 8; v++) vst1_s32(&y[n_ + 2 * v], vqrshrn_n_s64(acc[v], NN_FRACTIONAL_BITS));
+    }
+    if (n_vec < n) gemm_vm_scalar_wide(x, &b[n_vec], ldb, &y[n_vec], n - n_vec, k);
+}
+
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_neon, gemm_ukernel_neon)
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_neon_wide, gemm_ukernel_neon_wide)
+
+static const gemm_kernel_ops_t gemm_kernel_neon = {
+    .name = "neon",
+    .narrow = gemm_ukernel_neon,
+    .wide = gemm_ukernel_neon_wide,
+    .mv_narrow = gemm_mv_neon,
+    .mv_wide = gemm_mv_neon_wide,
+    .vm_narrow = gemm_vm_neon,
+    .vm_wide = gemm_vm_neon_wide,
+    .fixed_narrow = GEMM_FIXED_TABLE(gemm_fixed_neon),
+    .fixed_wide = GEMM_FIXED_TABLE(gemm_fixed_neon_wide),
+    .q16 = gemm_qukernel_scalar_q16,
+    .q8 = gemm_qukernel_scalar_q8,
+};
+#endif
+
+#if defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+// 16.16 multiply-accumulate of one row: widening multiply, then narrowing arithmetic shift
+#define GEMM_MAC_RVV(acc, b_row, a_val, vl) \
+    __riscv_vadd_vv_i32m2(acc, __riscv_vnsra_wx_i32m2(__riscv_vwmul_vx_i64m4(b_row, a_val, vl), NN_FRACTIONAL_BITS, vl), vl)
+
+_Static_assert(GEMM_MR == 4, "RVV microkernel is unrolled for 4 rows");
+
+// Vector-length agnostic: strip-mines the nr columns, so partial tiles need no fallback
+// -- RVV types are sizeless and cannot form arrays, hence the unrolled accumulators
+static void gemm_ukernel_rvv(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                             int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+
+    for (unsigned n_ = 0; n_ < nr; ) {
+        size_t vl = __riscv_vsetvl_e32m2(nr - n_);
+        vint32m2_t acc0 = __riscv_vmv_v_x_i32m2(0, vl), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            vint32m2_t b_row = __riscv_vle32_v_i32m2(&b[k_ * ldb + n_], vl);
+            acc0 = GEMM_MAC_RVV(acc0, b_row, a_row[0][k_], vl);
+            acc1 = GEMM_MAC_RVV(acc1, b_row, a_row[1][k_], vl);
+            acc2 = GEMM_MAC_RVV(acc2, b_row, a_row[2][k_], vl);
+            acc3 = GEMM_MAC_RVV(acc3, b_row, a_row[3][k_], vl);
+        }
+        __riscv_vse32_v_i32m2(&c[n_], acc0, vl);
+        if (mr > 1) __riscv_vse32_v_i32m2(&c[ldc + n_], acc1, vl);
+        if (mr > 2) __riscv_vse32_v_i32m2(&c[2 * ldc + n_], acc2, vl);
+        if (mr > 3) __riscv_vse32_v_i32m2(&c[3 * ldc + n_], acc3, vl);
+        n_ += vl;
+    }
+}
+
+// Wide accumulation with vwmacc; the once-per-output rescale is done in scalar code
+static void gemm_ukernel_rvv_wide(const int32_t *a, unsigned lda, const int32_t *b, unsigned ldb,
+                                  int32_t *c, unsigned ldc, unsigned k, unsigned mr, unsigned nr) {
+    const int32_t *a_row[GEMM_MR];
+    for (unsigned m_ = 0; m_ < GEMM_MR; m_++) a_row[m_] = &a[(m_ < mr ? m_ : 0) * lda];
+    int64_t sums[GEMM_MR][GEMM_NR];
+
+    for (unsigned n_ = 0; n_ < nr; ) {
+        size_t vl = __riscv_vsetvl_e32m2(nr - n_);
+        vint64m4_t acc0 = __riscv_vmv_v_x_i64m4(0, vl), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            vint32m2_t b_row = __riscv_vle32_v_i32m2(&b[k_ * ldb + n_], vl);
+            acc0 = __riscv_vwmacc_vx_i64m4(acc0, a_row[0][k_], b_row, vl);
+            acc1 = __riscv_vwmacc_vx_i64m4(acc1, a_row[1][k_], b_row, vl);
+            acc2 = __riscv_vwmacc_vx_i64m4(acc2, a_row[2][k_], b_row, vl);
+            acc3 = __riscv_vwmacc_vx_i64m4(acc3, a_row[3][k_], b_row, vl);
+        }
+        __riscv_vse64_v_i64m4(&sums[0][n_], acc0, vl);
+        __riscv_vse64_v_i64m4(&sums[1][n_], acc1, vl);
+        __riscv_vse64_v_i64m4(&sums[2][n_], acc2, vl);
+        __riscv_vse64_v_i64m4(&sums[3][n_], acc3, vl);
+        n_ += vl;
+    }
+    for (unsigned m_ = 0; m_ < mr; m_++)
+        for (unsigned n_ = 0; n_ < nr; n_++) c[m_ * ldc + n_] = nn_token_from_acc(sums[m_][n_]).value;
+}
+
+// Strip-mined dot products; the tail-undisturbed ops keep the lanes past a short final strip
+static void gemm_mv_rvv(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    size_t vlmax = __riscv_vsetvlmax_e32m2();
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        vint32m2_t acc = __riscv_vmv_v_x_i32m2(0, vlmax);
+        for (unsigned k_ = 0; k_ < k; ) {
+            size_t vl = __riscv_vsetvl_e32m2(k - k_);
+            vint32m2_t a_val = __riscv_vle32_v_i32m2(&a_row[k_], vl);
+            vint32m2_t x_val = __riscv_vle32_v_i32m2(&x[k_], vl);
+            vint32m2_t prod = __riscv_vnsra_wx_i32m2(__riscv_vwmul_vv_i64m4(a_val, x_val, vl), NN_FRACTIONAL_BITS, vl);
+            acc = __riscv_vadd_vv_i32m2_tu(acc, acc, prod, vl);
+            k_ += vl;
+        }
+        vint32m1_t sum = __riscv_vredsum_vs_i32m2_i32m1(acc, __riscv_vmv_v_x_i32m1(0, 1), vlmax);
+        y[m_] = __riscv_vmv_x_s_i32m1_i32(sum);
+    }
+}
+
+static void gemm_mv_rvv_wide(const int32_t *a, unsigned lda, const int32_t *x, int32_t *y, unsigned rows, unsigned k) {
+    size_t vlmax = __riscv_vsetvlmax_e32m2();
+    for (unsigned m_ = 0; m_ < rows; m_++) {
+        const int32_t *a_row = &a[m_ * lda];
+        vint64m4_t acc = __riscv_vmv_v_x_i64m4(0, vlmax);
+        for (unsigned k_ = 0; k_ < k; ) {
+            size_t vl = __riscv_vsetvl_e32m2(k - k_);
+            vint32m2_t a_val = __riscv_vle32_v_i32m2(&a_row[k_], vl);
+            vint32m2_t x_val = __riscv_vle32_v_i32m2(&x[k_], vl);
+            acc = __riscv_vwmacc_vv_i64m4_tu(acc, a_val, x_val, vl);
+            k_ += vl;
+        }
+        vint64m1_t sum = __riscv_vredsum_vs_i64m4_i64m1(acc, __riscv_vmv_v_x_i64m1(0, 1), vlmax);
+        y[m_] = nn_token_from_acc(__riscv_vmv_x_s_i64m1_i64(sum)).value;
+    }
+}
+
+static void gemm_vm_rvv(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    for (unsigned n_ = 0; n_ < n; ) {
+        size_t vl = __riscv_vsetvl_e32m2(n - n_);
+        vint32m2_t acc = __riscv_vmv_v_x_i32m2(0, vl);
+        for (unsigned k_ = 0; k_ < k; k_++) {
+            acc = GEMM_MAC_RVV(acc, __riscv_vle32_v_i32m2(&b[k_ * ldb + n_], vl), x[k_], vl);
+        }
+        __riscv_vse32_v_i32m2(&y[n_], acc, vl);
+        n_ += vl;
+    }
+}
+
+static void gemm_vm_rvv_wide(const int32_t *x, const int32_t *b, unsigned ldb, int32_t *y, unsigned n, unsigned k) {
+    int64_t sums[GEMM_NR];
+    for (unsigned n0 = 0; n0 < n; n0 += GEMM_NR) {
+        unsigned nr = (n0 + GEMM_NR < n) ? GEMM_NR : n - n0;
+        for (unsigned n_ = 0; n_ < nr; ) {
+            size_t vl = __riscv_vsetvl_e32m2(nr - n_);
+            vint64m4_t acc = __riscv_vmv_v_x_i64m4(0, vl);
+            for (unsigned k_ = 0; k_ < k; k_++) {
+                acc = __riscv_vwmacc_vx_i64m4(acc, x[k_], __riscv_vle32_v_i32m2(&b[k_ * ldb + n0 + n_], vl), vl);
+            }
+            __riscv_vse64_v_i64m4(&sums[n_], acc, vl);
+            n_ += vl;
+        }
+        for (unsigned n_ = 0; n_ < nr; n_++) y[n0 + n_] = nn_token_from_acc(sums[n_]).value;
+    }
+}
+
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_rvv, gemm_ukernel_rvv)
+GEMM_DEFINE_FIXED_ALL(, gemm_fixed_rvv_wide, gemm_ukernel_rvv_wide)
+
+static const gemm_kernel_ops_t gemm_kernel_rvv = {
+    .name = "rvv",
+    .narrow = gemm_ukernel_rvv,
+    .wide = gemm_ukernel_rvv_wide,
+    .mv_narrow = gemm_mv_rvv,
+    .mv_wide = gemm_mv_rvv_wide,
+    .vm_narrow = gemm_vm_rvv,
+    .vm_wide = gemm_vm_rvv_wide,
+    .fixed_narrow = GEMM_FIXED_TABLE(gemm_fixed_rvv),
+    .fixed_wide = GEMM_FIXED_TABLE(gemm_fixed_rvv_wide),
+    .q16 = gemm_qukernel_scalar_q16,
+    .q8 = gemm_qukernel_scalar_q8,
+};
+#endif
+
+// Pick the widest instruction set the host supports
+static const gemm_kernel_ops_t *gemm_detect_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return &gemm_kernel_avx512;
+    if (__builtin_cpu_supports("avx2")) return &gemm_kernel_avx2;
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    return &gemm_kernel_neon;
+#endif
+#if defined(__riscv_vector) && defined(__riscv_v_intrinsic)
+    return &gemm_kernel_rvv;
+#endif
+    return &gemm_kernel_scalar;
+}
+
+const gemm_kernel_ops_t *gemm_get_kernel() {
+    static const gemm_kernel_ops_t *kernel = NULL;
+    const gemm_kernel_ops_t *ops = __atomic_load_n(&kernel, __ATOMIC_ACQUIRE);
+    if (ops == NULL) {
+        // Detection is idempotent; concurrent first callers store the same pointer
+        ops = gemm_detect_kernel();
+        __atomic_store_n(&kernel, ops, __ATOMIC_RELEASE);
+        LOW_DEBUG(printf("[SW GEMM] Using %s GEMM microkernels\n", ops->name);)
+    }
+    return ops;
+}
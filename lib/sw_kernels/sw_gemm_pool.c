@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <common_defines.h>
+#include <nn_token.h>
+#include <sw_gemm.h>
+#include <sw_gemm_kernels.h>
+#ifdef DO_CPU_PIN
+#include <hpthread.h>
+#include <vam_backend.h>
+#endif
+
+////////////////////////////////////
+// Persistent thread pool for the software GEMM
+// -- C is split into GEMM_TASK_MR x GEMM_TASK_NR tiles, dealt out evenly to one deque per
+// -- worker (the caller is worker 0). Each worker drains its own deque from the head and,
+// -- once empty, steals from the tail of the others. Since all tiles of a call are known
+// -- up front, a deque is a [head, tail) range of tile indices packed in one 64-bit word,
+// -- tagged with the job generation, so pops and steals are a single CAS each.
+
+// Default pool size: 1 keeps the software GEMM single-threaded, 0 uses every online CPU
+#ifndef GEMM_POOL_THREADS
+#define GEMM_POOL_THREADS 1
+#endif
+#define GEMM_POOL_MAX_THREADS 64
+// Work tile of C handled by one task
+#define GEMM_TASK_MR (GEMM_MR * 2)
+#define GEMM_TASK_NR (GEMM_NR * 2)
+// Below this many MACs, waking the workers costs more than it saves
+#define GEMM_POOL_MIN_WORK (16 * 16 * 16)
+// Polls of the job generation before an idle worker goes to sleep
+#define GEMM_POOL_SPIN 4096
+
+// Deque word: generation (16) | head (24) | tail (24)
+#define DEQ_IDX_BITS 24
+#define DEQ_IDX_MASK ((1ULL << DEQ_IDX_BITS) - 1)
+#define DEQ_MAX_TASKS DEQ_IDX_MASK
+
+static inline uint64_t deq_pack(unsigned gen, unsigned head, unsigned tail) {
+    return ((uint64_t) (gen & 0xffff) << (2 * DEQ_IDX_BITS)) | ((uint64_t) head << DEQ_IDX_BITS) | tail;
+}
+static inline unsigned deq_gen(uint64_t d) { return (unsigned) (d >> (2 * DEQ_IDX_BITS)); }
+static inline unsigned deq_head(uint64_t d) { return (unsigned) ((d >> DEQ_IDX_BITS) & DEQ_IDX_MASK); }
+static inline unsigned deq_tail(uint64_t d) { return (unsigned) (d & DEQ_IDX_MASK); }
+
+// Per-worker deque, on its own cache line
+typedef struct {
+    uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} gemm_deque_t;
+
+// GEMM call currently being executed by the pool
+typedef struct {
+    gemm_ukernel_t ukernel;
+    const int32_t *a, *b, *packed;
+    int32_t *c;
+    unsigned dim_m, dim_n, dim_k;
+    unsigned tiles_n; // Tiles along n; tile t covers rows (t / tiles_n) and columns (t % tiles_n)
+    unsigned task_mr, task_nr; // Tile size, enlarged when the call has more than DEQ_MAX_TASKS tiles
+    unsigned remaining; // Tiles not yet computed
+    unsigned n_active; // Workers taking part in this call (a tuned shape may use fewer than the pool)
+    gemm_opts_t opts; // Copy of the caller's options, for the epilogue and quantized weights
+    const gemm_opts_t *epi; // &opts when the call has an epilogue, else NULL
+    const gemm_opts_t *quant; // &opts when B holds quantized weights, else NULL
+} gemm_job_t;
+
+typedef struct {
+    unsigned n_threads; // Including the caller
+    pthread_t th[GEMM_POOL_MAX_THREADS];
+    gemm_deque_t deq[GEMM_POOL_MAX_THREADS];
+    gemm_job_t job;
+    unsigned gen; // Published job generation
+    unsigned base_gen; // Generation when the workers were started
+    bool stop;
+    bool started;
+    pthread_mutex_t job_lock; // One caller at a time owns the pool
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake_cond;
+} gemm_pool_t;
+
+static gemm_pool_t pool = {
+    .n_threads = GEMM_POOL_THREADS,
+    .job_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake_cond = PTHREAD_COND_INITIALIZER,
+};
+// Serializes pool start/stop
+static pthread_mutex_t pool_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void gemm_pool_run_task(gemm_job_t *job, unsigned t) {
+    unsigned m0 = (t / job->tiles_n) * job->task_mr;
+    unsigned n0 = (t % job->tiles_n) * job->task_nr;
+    unsigned m1 = (m0 + job->task_mr < job->dim_m) ? m0 + job->task_mr : job->dim_m;
+    unsigned n1 = (n0 + job->task_nr < job->dim_n) ? n0 + job->task_nr : job->dim_n;
+    if (job->quant) {
+        gemm_qblock(job->quant, job->a, job->b, job->c, job->dim_n, job->dim_k, m0, m1, n0, n1, job->epi);
+    } else {
+        gemm_block(job->ukernel, job->a, job->b, job->packed, job->c, job->dim_n, job->dim_k, m0, m1, n0, n1, job->epi);
+    }
+    __atomic_fetch_sub(&job->remaining, 1, __ATOMIC_RELEASE);
+}
+
+// Claim a tile from the head (owner) or tail (thief) of deque w; false if empty or stale
+static bool gemm_pool_claim(unsigned w, unsigned gen, bool owner, unsigned *t) {
+    uint64_t d = __atomic_load_n(&pool.deq[w].range, __ATOMIC_ACQUIRE);
+    while (deq_gen(d) == (gen & 0xffff) && deq_head(d) < deq_tail(d)) {
+        unsigned head = deq_head(d), tail = deq_tail(d);
+        uint64_t next = owner ? deq_pack(gen, head + 1, tail) : deq_pack(gen, head, tail - 1);
+        if (__atomic_compare_exchange_n(&pool.deq[w].range, &d, next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *t = owner ? head : tail - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drain our own deque, then steal round-robin from the others until everything is claimed
+static void gemm_pool_work(unsigned self, unsigned gen) {
+    gemm_job_t *job = &pool.job;
+    unsigned n_threads = __atomic_load_n(&job->n_active, __ATOMIC_RELAXED);
+    unsigned t;
+    if (self >= n_threads) return;
+    while (gemm_pool_claim(self, gen, true, &t)) gemm_pool_run_task(job, t);
+    for (unsigned i = 1; i < n_threads; i++) {
+        unsigned victim = (self + i) % n_threads;
+        while (gemm_pool_claim(victim, gen, false, &t)) gemm_pool_run_task(job, t);
+    }
+}
+
+static void *gemm_pool_worker(void *arg) {
+    unsigned self = (unsigned) (uintptr_t) arg;
+    unsigned seen = pool.base_gen;
+    while (1) {
+        // Spin briefly for back-to-back calls, then sleep until the next job
+        unsigned gen;
+        unsigned spin = 0;
+        while ((gen = __atomic_load_n(&pool.gen, __ATOMIC_ACQUIRE)) == seen && spin++ < GEMM_POOL_SPIN) {
+            if (__atomic_load_n(&pool.stop, __ATOMIC_ACQUIRE)) return NULL;
+        }
+        if (gen == seen) {
+            pthread_mutex_lock(&pool.wake_lock);
+            while ((gen = __atomic_load_n(&pool.gen, __ATOMIC_ACQUIRE)) == seen && !pool.stop)
+                pthread_cond_wait(&pool.wake_cond, &pool.wake_lock);
+            pthread_mutex_unlock(&pool.wake_lock);
+        }
+        if (__atomic_load_n(&pool.stop, __ATOMIC_ACQUIRE)) return NULL;
+        seen = gen;
+        // A late wakeup may see the job fields of a newer call; the generation tag on the
+        // deques makes every claim for a stale generation fail.
+        gemm_pool_work(self, gen);
+    }
+    return NULL;
+}
+
+static void gemm_pool_start() {
+    unsigned n_threads = pool.n_threads;
+    if (n_threads == 0) n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > GEMM_POOL_MAX_THREADS) n_threads = GEMM_POOL_MAX_THREADS;
+    pool.n_threads = n_threads;
+    pool.stop = false;
+    pool.base_gen = pool.gen;
+    for (unsigned i = 0; i < GEMM_POOL_MAX_THREADS; i++) pool.deq[i].range = 0;
+
+    for (unsigned i = 1; i < n_threads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        #ifdef DO_CPU_PIN
+        // Take cores from VAM's round-robin, so workers do not stack on pinned hpthreads;
+        // the caller keeps its own affinity as worker 0
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(vam_next_core(), &set);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
+            perror("pthread_attr_setaffinity_np");
+        }
+        #endif
+        if (pthread_create(&pool.th[i], &attr, gemm_pool_worker, (void *) (uintptr_t) i) != 0) {
+            perror("pthread_create");
+            n_threads = i;
+            pthread_attr_destroy(&attr);
+            break;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pool.n_threads = n_threads;
+    __atomic_store_n(&pool.started, true, __ATOMIC_RELEASE);
+    LOW_DEBUG(printf("[SW GEMM] Started GEMM pool with %d threads\n", n_threads);)
+}
+
+void gemm_pool_release() {
+    pthread_mutex_lock(&pool_ctl_lock);
+    pthread_mutex_lock(&pool.job_lock);
+    if (pool.started) {
+        pthread_mutex_lock(&pool.wake_lock);
+        __atomic_store_n(&pool.stop, true, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pool.wake_cond);
+        pthread_mutex_unlock(&pool.wake_lock);
+        for (unsigned i = 1; i < pool.n_threads; i++) pthread_join(pool.th[i], NULL);
+        __atomic_store_n(&pool.started, false, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pool.job_lock);
+    pthread_mutex_unlock(&pool_ctl_lock);
+}
+
+void gemm_pool_setthreads(unsigned n_threads) {
+    gemm_pool_release();
+    pthread_mutex_lock(&pool_ctl_lock);
+    pool.n_threads = n_threads;
+    pthread_mutex_unlock(&pool_ctl_lock);
+}
+
+unsigned gemm_pool_getthreads() {
+    return pool.n_threads;
+}
+
+void gemm_parallel(const nn_token_t* mat_a, const nn_token_t* mat_b, nn_token_t* mat_c, unsigned dim_m, unsigned dim_n, unsigned dim_k, const gemm_opts_t *opts) {
+    // Without options (plain calls) the shape is looked up once here and passed on to gemm_ex()
+    gemm_opts_t defaults;
+    if (!opts) {
+        gemm_opts_default(&defaults, gemm_tune_lookup(dim_m, dim_n, dim_k));
+        opts = &defaults;
+    }
+    const gemm_tune_t *tune = opts->tune;
+    // GEMV shapes are memory-bound and have their own kernels in gemm_ex()
+    if (pool.n_threads == 1 || (tune && tune->threads == 1) || dim_m == 1 || dim_n == 1 ||
+        (uint64_t) dim_m * dim_n * dim_k < GEMM_POOL_MIN_WORK) {
+        gemm_ex(mat_a, mat_b, mat_c, dim_m, dim_n, dim_k, opts);
+        return;
+    }
+    if (!__atomic_load_n(&pool.started, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&pool_ctl_lock);
+        if (!pool.started) gemm_pool_start();
+        pthread_mutex_unlock(&pool_ctl_lock);
+    }
+    // Another caller owns the pool: don't oversubscribe the cores, just run inline
+    if (pthread_mutex_trylock(&pool.job_lock) != 0) {
+        gemm_ex(mat_a, mat_b, mat_c, dim_m, dim_n, dim_k, opts);
+        return;
+    }
+    if (!pool.started || pool.n_threads == 1) {
+        pthread_mutex_unlock(&pool.job_lock);
+        gemm_ex(mat_a, mat_b, mat_c, dim_m, dim_n, dim_k, opts);
+        return;
+    }
+
+    // Publish the job; tiles must stay multiples of GEMM_NR wide for the packed panels
+    gemm_job_t *job = &pool.job;
+    job->ukernel = gemm_select_ukernel(opts);
+    job->a = (const int32_t *) mat_a;
+    job->b = (const int32_t *) mat_b;
+    job->packed = (opts && opts->packed_b) ? (const int32_t *) opts->packed_b : NULL;
+    job->c = (int32_t *) mat_c;
+    if (opts) job->opts = *opts;
+    job->epi = gemm_opts_has_epilogue(opts) ? &job->opts : NULL;
+    job->quant = (opts && opts->prec != GEMM_PREC_Q32) ? &job->opts : NULL;
+    job->dim_m = dim_m; job->dim_n = dim_n; job->dim_k = dim_k;
+    job->task_mr = (tune && tune->tile_m) ? tune->tile_m : GEMM_TASK_MR;
+    job->task_nr = (tune && tune->tile_n) ? tune->tile_n : GEMM_TASK_NR;
+    unsigned tiles_m, n_tasks;
+    while (1) {
+        tiles_m = (dim_m + job->task_mr - 1) / job->task_mr;
+        job->tiles_n = (dim_n + job->task_nr - 1) / job->task_nr;
+        n_tasks = tiles_m * job->tiles_n;
+        if (n_tasks <= DEQ_MAX_TASKS) break;
+        job->task_mr *= 2; job->task_nr *= 2;
+    }
+    job->remaining = n_tasks;
+    unsigned gen = pool.gen + 1;
+    unsigned n_threads = (tune && tune->threads && tune->threads < pool.n_threads) ? tune->threads : pool.n_threads;
+    __atomic_store_n(&job->n_active, n_threads, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < n_threads; i++) {
+        unsigned head = (unsigned) (((uint64_t) n_tasks * i) / n_threads);
+        unsigned tail = (unsigned) (((uint64_t) n_tasks * (i + 1)) / n_threads);
+        __atomic_store_n(&pool.deq[i].range, deq_pack(gen, head, tail), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_lock(&pool.wake_lock);
+    __atomic_store_n(&pool.gen, gen, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake_cond);
+    pthread_mutex_unlock(&pool.wake_lock);
+
+    // Work as worker 0, then wait for tiles still in flight on the other workers
+    gemm_pool_work(0, gen);
+    while (__atomic_load_n(&job->remaining, __ATOMIC_ACQUIRE) != 0) SCHED_YIELD;
+    pthread_mutex_unlock(&pool.job_lock);
+}
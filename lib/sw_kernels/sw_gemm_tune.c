@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <common_defines.h>
+#include <nn_token.h>
+#include <sw_gemm.h>
+#include <sw_gemm_kernels.h>
+
+////////////////////////////////////
+// Per-shape tuning table for the software GEMM
+// -- gemm_tune_shape() times every candidate tiling, loop order and thread count for one
+// -- (m, n, k) and keeps the fastest; the table is saved as a small text file and loaded
+// -- back by the first GEMM call of every process on the same machine.
+
+// Largest tiles tried, as multiples of the register block
+#define GEMM_TUNE_TILE_M_STEPS 5 // GEMM_MR x 1, 2, 4, 8, 16
+#define GEMM_TUNE_TILE_N_STEPS 3 // GEMM_NR x 1, 2, 4
+
+// Entries are immutable once published: a replacement is a new copy swapped in with a release
+// store, so a layer that resolved its slot never reads a half-written entry. Replaced copies are
+// not freed, since a running GEMM may still hold them; writers serialize on tune_lock.
+static const gemm_tune_t *tune_table[GEMM_TUNE_MAX];
+static unsigned tune_count;
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tune_once = PTHREAD_ONCE_INIT;
+
+// Add or replace an entry; tiles are rounded up to whole register blocks
+static void gemm_tune_put(const gemm_tune_t *cfg) {
+    gemm_tune_t *e = (gemm_tune_t *) malloc(sizeof(gemm_tune_t));
+    *e = *cfg;
+    if (e->tile_m) e->tile_m = (e->tile_m + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    if (e->tile_n) e->tile_n = (e->tile_n + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+    pthread_mutex_lock(&tune_lock);
+    for (unsigned i = 0; i < tune_count; i++) {
+        const gemm_tune_t *cur = tune_table[i];
+        if (cur && cur->dim_m == e->dim_m && cur->dim_n == e->dim_n && cur->dim_k == e->dim_k) {
+            __atomic_store_n(&tune_table[i], e, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&tune_lock);
+            return;
+        }
+    }
+    if (tune_count == GEMM_TUNE_MAX) {
+        pthread_mutex_unlock(&tune_lock);
+        printf("[SW GEMM] Tuning table full, dropping %dx%dx%d\n", e->dim_m, e->dim_n, e->dim_k);
+        free(e);
+        return;
+    }
+    __atomic_store_n(&tune_table[tune_count], e, __ATOMIC_RELEASE);
+    __atomic_store_n(&tune_count, tune_count + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tune_lock);
+}
+
+static int gemm_tune_read(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        gemm_tune_t e;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%u %u %u %u %u %u %u", &e.dim_m, &e.dim_n, &e.dim_k, &e.tile_m, &e.tile_n, &e.order, &e.threads) != 7) continue;
+        gemm_tune_put(&e);
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static void gemm_tune_init() {
+    const char *path = getenv("GEMM_TUNE_FILE");
+    if (!path) path = GEMM_TUNE_FILE;
+    int count = gemm_tune_read(path);
+    LOW_DEBUG(if (count >= 0) printf("[SW GEMM] Loaded %d tuned shapes from %s\n", count, path);)
+    (void) count;
+}
+
+unsigned gemm_tune_slot(unsigned m, unsigned n, unsigned k) {
+    pthread_once(&tune_once, gemm_tune_init);
+    unsigned count = __atomic_load_n(&tune_count, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < count; i++) {
+        const gemm_tune_t *e = __atomic_load_n(&tune_table[i], __ATOMIC_ACQUIRE);
+        if (e && e->dim_m == m && e->dim_n == n && e->dim_k == k) return i + 1;
+    }
+    return 0;
+}
+
+const gemm_tune_t *gemm_tune_get(unsigned slot, unsigned m, unsigned n, unsigned k) {
+    if (slot == 0 || slot > GEMM_TUNE_MAX) return NULL;
+    const gemm_tune_t *e = __atomic_load_n(&tune_table[slot - 1], __ATOMIC_ACQUIRE);
+    // A cleared table may have given the slot to another shape since it was resolved
+    return (e && e->dim_m == m && e->dim_n == n && e->dim_k == k) ? e : NULL;
+}
+
+const gemm_tune_t *gemm_tune_lookup(unsigned m, unsigned n, unsigned k) {
+    return gemm_tune_get(gemm_tune_slot(m, n, k), m, n, k);
+}
+
+void gemm_tune_set(const gemm_tune_t *cfg) {
+    pthread_once(&tune_once, gemm_tune_init);
+    gemm_tune_put(cfg);
+}
+
+void gemm_tune_clear() {
+    pthread_once(&tune_once, gemm_tune_init);
+    pthread_mutex_lock(&tune_lock);
+    for (unsigned i = 0; i < tune_count; i++) __atomic_store_n(&tune_table[i], NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&tune_count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tune_lock);
+}
+
+int gemm_tune_load(const char *path) {
+    pthread_once(&tune_once, gemm_tune_init);
+    return gemm_tune_read(path);
+}
+
+int gemm_tune_save(const char *path) {
+    pthread_once(&tune_once, gemm_tune_init);
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "# m n k tile_m tile_n order threads\n");
+    pthread_mutex_lock(&tune_lock);
+    unsigned count = tune_count;
+    for (unsigned i = 0; i < count; i++) {
+        const gemm_tune_t *e = tune_table[i];
+        fprintf(f, "%u %u %u %u %u %u %u\n", e->dim_m, e->dim_n, e->dim_k, e->tile_m, e->tile_n, e->order, e->threads);
+    }
+    pthread_mutex_unlock(&tune_lock);
+    fclose(f);
+    return count;
+}
+
+static uint64_t gemm_tune_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Best-of-reps time of the GEMM through the normal dispatch with cfg as its tuning
+static uint64_t gemm_tune_time(const gemm_tune_t *cfg, const nn_token_t *a, const nn_token_t *b, nn_token_t *c, unsigned reps) {
+    gemm_opts_t opts;
+    gemm_opts_default(&opts, NULL);
+    opts.tune = cfg;
+    uint64_t best = UINT64_MAX;
+    gemm_parallel(a, b, c, cfg->dim_m, cfg->dim_n, cfg->dim_k, &opts); // Warm up caches and the pool
+    for (unsigned r = 0; r < reps; r++) {
+        uint64_t t_start = gemm_tune_now();
+        gemm_parallel(a, b, c, cfg->dim_m, cfg->dim_n, cfg->dim_k, &opts);
+        uint64_t t = gemm_tune_now() - t_start;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+// Thread counts tried: powers of two, then the full pool
+static unsigned gemm_tune_next_threads(unsigned threads, unsigned max_threads) {
+    return (threads < max_threads && threads * 2 > max_threads) ? max_threads : threads * 2;
+}
+
+void gemm_tune_shape(unsigned m, unsigned n, unsigned k, unsigned reps, gemm_tune_t *best) {
+    pthread_once(&tune_once, gemm_tune_init);
+    nn_token_t *a = (nn_token_t *) malloc((size_t) m * k * sizeof(nn_token_t));
+    nn_token_t *b = (nn_token_t *) malloc((size_t) k * n * sizeof(nn_token_t));
+    nn_token_t *c = (nn_token_t *) malloc((size_t) m * n * sizeof(nn_token_t));
+    for (unsigned i = 0; i < m * k; i++) a[i] = nn_token_from_float((float) rand() / (float) RAND_MAX);
+    for (unsigned i = 0; i < k * n; i++) b[i] = nn_token_from_float((float) rand() / (float) RAND_MAX);
+    unsigned max_threads = gemm_pool_getthreads();
+    if (max_threads == 0) max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // The built-in dispatch is the first candidate, so a tuned entry never loses to it
+    gemm_tune_t cfg = { .dim_m = m, .dim_n = n, .dim_k = k };
+    *best = cfg;
+    uint64_t best_time = gemm_tune_time(&cfg, a, b, c, reps);
+    for (unsigned threads = 1; threads <= max_threads; threads = gemm_tune_next_threads(threads, max_threads)) {
+        // With more than one thread the tiles are pool tasks and the pool decides the order
+        unsigned orders = (threads == 1) ? 2 : 1;
+        for (unsigned order = 0; order < orders; order++) {
+            for (unsigned i = 0; i <= GEMM_TUNE_TILE_M_STEPS; i++) {
+                unsigned tile_m = (i == GEMM_TUNE_TILE_M_STEPS) ? 0 : GEMM_MR << i;
+                if (tile_m >= m + GEMM_MR) continue;
+                for (unsigned j = 0; j <= GEMM_TUNE_TILE_N_STEPS; j++) {
+                    unsigned tile_n = (j == GEMM_TUNE_TILE_N_STEPS) ? 0 : GEMM_NR << j;
+                    if (tile_n >= n + GEMM_NR) continue;
+                    // Whole-matrix tiles in the default order on one thread are the built-in choice
+                    if (threads == 1 && tile_m == 0 && tile_n == 0 && order == GEMM_ORDER_N_OUTER) continue;
+                    cfg = (gemm_tune_t) { m, n, k, tile_m, tile_n, order, threads };
+                    uint64_t t = gemm_tune_time(&cfg, a, b, c, reps);
+                    HIGH_DEBUG(printf("[SW GEMM] %dx%dx%d tile %dx%d order %d threads %d: %lu ns\n", m, n, k, tile_m, tile_n, order, threads, t);)
+                    if (t < best_time) {
+                        best_time = t;
+                        *best = cfg;
+                    }
+                }
+            }
+        }
+    }
+    gemm_tune_put(best);
+    LOW_DEBUG(printf("[SW GEMM] Tuned %dx%dx%d: tile %dx%d order %d threads %d (%lu ns)\n", m, n, k,
+        best->tile_m, best->tile_n, best->order, best->threads, best_time);)
+    free(a); free(b); free(c);
+}
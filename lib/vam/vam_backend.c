@@ -4,6 +4,7 @@
 #include <vam_physical_accel.h>
 #include <vam_backend.h>
 #include <vam_accel_def.h>
+#include <sm_queue.h>
 #include <libesp.h>
 #include <esp.h>
 #include <esp_accelerator.h>
@@ -17,8 +18,6 @@
 
 // ESP API for getting contig_alloc handle
 extern contig_handle_t *lookup_handle(void *buf, enum contig_alloc_policy *policy);
-// External instance of hpthread interface
-extern hpthread_intf_t intf;
 // Used in wakeup_vam()
 pthread_t vam_th;
 // Physical accelerator list
@@ -33,10 +32,18 @@ float max_util, min_util;
 float load_imbalance_reg;
 // Counter for core affinity
 #ifdef DO_CPU_PIN
-static uint8_t core_affinity_ctr = 0;
+static unsigned core_affinity_ctr = 0;
 #endif
 // Number of CPUs online
 long cpu_online;
+
+#ifdef DO_CPU_PIN
+// Next core in the round-robin shared by VAM, its CPU threads and the GEMM pool workers
+unsigned vam_next_core() {
+    long online = cpu_online ? cpu_online : sysconf(_SC_NPROCESSORS_ONLN);
+    return __atomic_fetch_add(&core_affinity_ctr, 1, __ATOMIC_RELAXED) % online;
+}
+#endif
 // Physical accelerator list
 hpthread_cand_t *hpthread_cand_list = NULL;
 #ifndef LITE_REPORT
@@ -44,6 +51,13 @@ hpthread_cand_t *hpthread_cand_list = NULL;
 unsigned util_epoch_count = 0;
 #endif
 
+// Monotonic time in ns, for pacing the load balancer
+static uint64_t vam_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
 // Function to wake up VAM for the first time
 void wakeup_vam() {
 	HIGH_DEBUG(printf("[VAM] Launching a new thread for VAM BACKEND!\n");)
@@ -58,7 +72,7 @@ void wakeup_vam() {
     // Set CPU affinity
     cpu_set_t set;
     CPU_ZERO(&set);
-    CPU_SET((core_affinity_ctr++) % cpu_online, &set);
+    CPU_SET(vam_next_core(), &set);
     if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
         perror("pthread_attr_setaffinity_np");
     }
@@ -176,6 +190,7 @@ void *vam_run_backend(void *arg) {
     #endif
     // populate the list of physical accelerators in the system
     vam_probe_accel();
+    vam_publish_snapshot();
     bool kill_vam = false;
 
     const float LB_RESET = 0.10;
@@ -184,90 +199,124 @@ void *vam_run_backend(void *arg) {
     unsigned NUM_LB_RETRY = MAX_LB_RETRY;
     unsigned RESET_COUNTER = 10;
 
+    // Load balancing runs every VAM_SLEEP; requests are served as soon as they arrive
+    uint64_t next_epoch = vam_now_ns();
+
     // Run loop will run forever
     while (1) {
-        // Test the interface state
-        uint8_t state = hpthread_intf_test();
-
-        switch(state) {
-            case VAM_IDLE: {
-                // Examine the util across all accelerators in the system                
-                float load_imbalance = vam_check_load_balance();
-                    
-                #ifndef DISABLE_LB
-                bool need_load_balance = false;
-                if (load_imbalance > LB_TRIG && NUM_LB_RETRY > 0) {
-                    need_load_balance = true;
-                } else {
-                    RESET_COUNTER--;
+        // Serve all queued requests
+        hpthread_req_t *req;
+        while (!kill_vam && (req = hpthread_intf_next()) != NULL) {
+            // Requests that move contexts publish a new snapshot before the requester resumes
+            bool publish = false;
+            switch(req->op) {
+                case VAM_CREATE: {
+                    HIGH_DEBUG(printf("[VAM] Received a request for creating %d hpthread(s) from %s\n", req->n, hpthread_get_name(req->th[0]));)
+                    vam_search_accel_n(req->th, req->n);
+                    publish = true;
+                    break;
                 }
-
-                if (RESET_COUNTER == 0) {
-                    RESET_COUNTER = 10;
-                    NUM_LB_RETRY = MAX_LB_RETRY;
-                    if (load_imbalance > LB_RESET) {
-                        need_load_balance = true;
+                case VAM_JOIN: {
+                    HIGH_DEBUG(printf("[VAM] Received a request for joining %d hpthread(s) from %s\n", req->n, hpthread_get_name(req->th[0]));)
+                    for (unsigned i = 0; i < req->n; i++) {
+                        vam_release_accel(req->th[i]);
                     }
+                    publish = true;
+                    break;
                 }
-
-                if (need_load_balance) {
-                    LOW_DEBUG(printf("[VAM] Trigerring load balancer, imbalance=%0.2f\n", load_imbalance);)
-                    if (!vam_load_balance()) {
-                        // If load balance was not successful, reduce retry count
-                        NUM_LB_RETRY--;
-                    } else {
-                        // Successful load balance; reset retry count
-                        NUM_LB_RETRY = MAX_LB_RETRY;
+                case VAM_SETPRIO: {
+                    HIGH_DEBUG(printf("[VAM] Received a request for changing priority hpthread %s to %d\n", hpthread_get_name(req->th[0]), req->th[0]->nprio);)
+                    vam_setprio_accel(req->th[0]);
+                    break;
+                }
+                case VAM_REBIND: {
+                    HIGH_DEBUG(printf("[VAM] Received a request for rebinding %d hpthread(s) from %s\n", req->n, hpthread_get_name(req->th[0]));)
+                    for (unsigned i = 0; i < req->n; i++) {
+                        vam_rebind_accel(req->th[i], req->args[i]);
                     }
-                    load_imbalance_reg = load_imbalance;
+                    publish = true;
+                    break;
                 }
-                #endif
-                break;
-            }
-            case VAM_CREATE: {
-                HIGH_DEBUG(printf("[VAM] Received a request for creating hpthread %s\n", hpthread_get_name(intf.th));)
-                vam_search_accel(intf.th);
-                break;
-            }
-            case VAM_JOIN: {
-                HIGH_DEBUG(printf("[VAM] Received a request for joining hpthread %s\n", hpthread_get_name(intf.th));)
-                vam_release_accel(intf.th);
-                break;
+                case VAM_REPORT: {
+                    HIGH_DEBUG(printf("[VAM] Received a report request\n");)
+                    vam_print_report();
+                    kill_vam = true;
+                    break;
+                }
+                case VAM_QUERY: {
+                    HIGH_DEBUG(printf("[VAM] Received a query request\n");)
+                    req->list = hpthread_cand_list;
+                    break;
+                }
+                default:
+                    break;
             }
-            case VAM_SETPRIO: {
-                HIGH_DEBUG(printf("[VAM] Received a request for changing priority hpthread %s to %d\n", hpthread_get_name(intf.th), intf.th->nprio);)
-                vam_setprio_accel(intf.th);
-                break;
+            if (publish) vam_publish_snapshot();
+            // Wake up the requester
+            hpthread_intf_complete(req);
+        }
+        if (kill_vam) break;
+
+        uint64_t now = vam_now_ns();
+        if (now >= next_epoch) {
+            // Examine the util across all accelerators in the system
+            float load_imbalance = vam_check_load_balance();
+
+            #ifndef DISABLE_LB
+            bool need_load_balance = false;
+            if (load_imbalance > LB_TRIG && NUM_LB_RETRY > 0) {
+                need_load_balance = true;
+            } else {
+                RESET_COUNTER--;
             }
-            case VAM_REPORT: {
-                HIGH_DEBUG(printf("[VAM] Received a report request\n");)
-                vam_print_report();
-                kill_vam = true;
-                break;
+
+            if (RESET_COUNTER == 0) {
+                RESET_COUNTER = 10;
+                NUM_LB_RETRY = MAX_LB_RETRY;
+                if (load_imbalance > LB_RESET) {
+                    need_load_balance = true;
+                }
             }
-            case VAM_QUERY: {
-                HIGH_DEBUG(printf("[VAM] Received a query request\n");)
-                intf.list = hpthread_cand_list;
-                break;
+
+            if (need_load_balance) {
+                LOW_DEBUG(printf("[VAM] Trigerring load balancer, imbalance=%0.2f\n", load_imbalance);)
+                if (!vam_load_balance()) {
+                    // If load balance was not successful, reduce retry count
+                    NUM_LB_RETRY--;
+                } else {
+                    // Successful load balance; reset retry count
+                    NUM_LB_RETRY = MAX_LB_RETRY;
+                }
+                load_imbalance_reg = load_imbalance;
             }
-            default:
-                break;
-        }
-        // If there was a request, set the state to done.
-        if (state > VAM_DONE) {
-            // Set the interface state to DONE
-            hpthread_intf_set(VAM_DONE);
+            #endif
+            vam_publish_snapshot();
+            next_epoch = now + VAM_SLEEP * 1000ull;
+            now = vam_now_ns();
         }
-        if (kill_vam) break;
-        usleep(VAM_SLEEP);
+        // Sleep until the next epoch, or until a request rings the doorbell
+        if (now < next_epoch) hpthread_intf_sleep(next_epoch - now);
     }
     return NULL;
 }
 
 void vam_search_accel(hpthread_t *th) {
-    HIGH_DEBUG(printf("[VAM] Searching accelerator for hpthread %s with affinity to ID %d\n", hpthread_get_name(th), th->affinity);)
-    // First, update the active utilization of each accelerator
+    vam_search_accel_n(&th, 1);
+}
+
+void vam_search_accel_n(hpthread_t **th, unsigned n) {
+    // First, update the active utilization of each accelerator, once for the whole batch
     vam_check_utilization();
+    // Place the hpthreads in order; the contexts and expected load of earlier ones steer the
+    // later ones away, until the next utilization check measures the real load
+    for (unsigned i = 0; i < n; i++) {
+        vam_place_accel(th[i]);
+        th[i]->accel->effective_util += 1.0 / th[i]->nprio;
+    }
+}
+
+void vam_place_accel(hpthread_t *th) {
+    HIGH_DEBUG(printf("[VAM] Searching accelerator for hpthread %s with affinity to ID %d\n", hpthread_get_name(th), th->affinity);)
 
     // We will find a candidate accelerator that has the lowest utiilization.
     // If no accelerator candidates are found, we will consider the CPU as the only candidate.
@@ -332,7 +381,12 @@ void vam_search_accel(hpthread_t *th) {
         // Create a new physical accelerator for this CPU thread
         physical_accel_t *cpu_thread = (physical_accel_t *) malloc(sizeof(physical_accel_t));
         cpu_thread->prim = PRIM_NONE;
-        LOW_DEBUG(strcpy(cpu_thread->devname, "CPU");)
+        cpu_thread->cpu_invoke = false;
+        cpu_thread->init_done = false;
+        cpu_thread->effective_util = 0.0;
+        cpu_thread->util_entry_list = NULL;
+        bitset_reset_all(cpu_thread->valid_contexts);
+        strcpy(cpu_thread->devname, "CPU");
         candidate_accel = cpu_thread;
         insert_cpu_thread(cpu_thread);
         candidate_util = 0.0;
@@ -396,6 +450,8 @@ void vam_configure_accel(hpthread_t *th, physical_accel_t *accel, unsigned conte
         exit(EXIT_FAILURE);
     }    
     accel->init_done = true;
+    // The context now follows the hpthread's binding
+    hpthread_args_ack(th->args, hpthread_args_bind(th->args));
     // Read the current time for when the accelerator is started.
     accel->context_start_cycles[context] = get_counter();
     accel->context_active_cycles[context] = 0;
@@ -426,7 +482,7 @@ void vam_configure_cpu_invoke(hpthread_t *th, physical_accel_t *accel, unsigned
     // Set CPU affinity
     cpu_set_t set;
     CPU_ZERO(&set);
-    CPU_SET((core_affinity_ctr++) % cpu_online, &set);
+    CPU_SET(vam_next_core(), &set);
     if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
         perror("pthread_attr_setaffinity_np");
     }
@@ -478,7 +534,7 @@ void vam_configure_cpu_invoke(hpthread_t *th, physical_accel_t *accel, unsigned
         // Set CPU affinity
         cpu_set_t set;
         CPU_ZERO(&set);
-        CPU_SET((core_affinity_ctr++) % cpu_online, &set);
+        CPU_SET(vam_next_core(), &set);
         if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
             perror("pthread_attr_setaffinity_np");
         }
@@ -516,9 +572,25 @@ void vam_configure_cpu(hpthread_t *th, physical_accel_t *accel) {
     // Create a new CPU thread for the SW implementation of this node.
     pthread_t cpu_thread;
     th->args->kill_pthread = (bool *) malloc (sizeof(bool)); *(th->args->kill_pthread) = false;
-    if (pthread_create(&cpu_thread, NULL, sw_kernel, (void *) th->args) != 0) {
+    // Create pthread attributes
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0) {
+        perror("attr_init");
+    }
+    #ifdef DO_CPU_PIN
+    // Set CPU affinity
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(vam_next_core(), &set);
+    if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
+        perror("pthread_attr_setaffinity_np");
+    }
+    #endif
+    if (pthread_create(&cpu_thread, &attr, sw_kernel, (void *) th->args) != 0) {
         perror("Failed to create CPU thread\n");
     }
+    pthread_attr_destroy(&attr);
+    accel->init_done = true;
 
     // Add this thread to the physical_accel struct
 #ifdef DO_PER_INVOKE
@@ -528,6 +600,12 @@ void vam_configure_cpu(hpthread_t *th, physical_accel_t *accel) {
 #endif
 }
 
+// Wake the worker of an hpthread if it sleeps on its input queue, e.g. after asking it to exit
+static void vam_wake_worker(hpthread_t *th) {
+    hpthread_args_t *a = th->args;
+    sm_queue_notify((sm_queue_t *) ((unsigned *) (a->mem) + a->queue_ptr), SM_QUEUE_PUSHED);
+}
+
 void vam_release_accel(hpthread_t *th) {
     physical_accel_t *accel = th->accel;
     unsigned context = th->accel_context;
@@ -535,9 +613,28 @@ void vam_release_accel(hpthread_t *th) {
     // Free the allocated context.
     bitset_reset(accel->valid_contexts, context);
 
+    // CPU threads are released first, regardless of how the hpthread wanted to be invoked
+    if (accel->prim == PRIM_NONE) {
+        __atomic_store_n(th->args->kill_pthread, true, __ATOMIC_RELEASE);
+        vam_wake_worker(th);
+#ifdef DO_PER_INVOKE
+        pthread_join(accel->cpu_thread[0], NULL);
+#else
+        pthread_join(accel->cpu_thread, NULL);
+#endif
+        free(th->args->kill_pthread);
+        th->args->kill_pthread = NULL;
+        // The CPU thread struct is not reused; remove it from the list
+        remove_cpu_thread(accel);
+        free(accel);
+        th->accel = NULL;
+        return;
+    }
+
     if (th->cpu_invoke) {
 #ifdef DO_PER_INVOKE
-        accel->args[context]->kill_pthread = true;
+        __atomic_store_n(&(accel->args[context]->kill_pthread), true, __ATOMIC_RELEASE);
+        vam_wake_worker(th);
         pthread_join(accel->cpu_thread[context], NULL);
 #else
         while(bitset_test(accel->args->valid_contexts_ack, context)) {
@@ -545,28 +642,19 @@ void vam_release_accel(hpthread_t *th) {
         }
 #endif
     } else {
-        if (accel->prim == PRIM_NONE) {
-            *(th->args->kill_pthread) = true;
-#ifdef DO_PER_INVOKE
-            pthread_join(accel->cpu_thread[0], NULL);
-#else
-            pthread_join(accel->cpu_thread, NULL);
-#endif
-        } else {
-            struct esp_access *esp_access_desc = accel->esp_access_desc;
-            {
-                esp_access_desc->context_id = context;
-                esp_access_desc->valid_contexts = accel->valid_contexts;
-                esp_access_desc->ioctl_cm = ESP_IOCTL_ACC_DEL_CONTEXT;
-            }
-            if (ioctl(accel->fd, accel->ioctl_cm, esp_access_desc)) {
-                perror("ioctl");
-                exit(EXIT_FAILURE);
-            }
-            // If there is no context active, we should re-init the accelerator the next time
-            if (bitset_none(accel->valid_contexts)) {
-                accel->init_done = false;
-            }
+        struct esp_access *esp_access_desc = accel->esp_access_desc;
+        {
+            esp_access_desc->context_id = context;
+            esp_access_desc->valid_contexts = accel->valid_contexts;
+            esp_access_desc->ioctl_cm = ESP_IOCTL_ACC_DEL_CONTEXT;
+        }
+        if (ioctl(accel->fd, accel->ioctl_cm, esp_access_desc)) {
+            perror("ioctl");
+            exit(EXIT_FAILURE);
+        }
+        // If there is no context active, we should re-init the accelerator the next time
+        if (bitset_none(accel->valid_contexts)) {
+            accel->init_done = false;
         }
     }
 
@@ -575,10 +663,48 @@ void vam_release_accel(hpthread_t *th) {
     th->accel = NULL;
 }
 
+void vam_rebind_accel(hpthread_t *th, hpthread_args_t *args) {
+    physical_accel_t *accel = th->accel;
+    unsigned context = th->accel_context;
+    hpthread_args_t *a = th->args;
+    LOW_DEBUG(printf("[VAM] Rebinding accel %s:%d for hpthread %s to queue %d\n", physical_accel_get_name(accel), context, hpthread_get_name(th), args->queue_ptr);)
+    sm_queue_t *old_q = (sm_queue_t *) ((unsigned *) (a->mem) + a->queue_ptr);
+    a->mem = args->mem;
+    a->queue_ptr = args->queue_ptr;
+    unsigned seq = a->bind_seq + 1;
+
+    if (accel->prim == PRIM_NONE || th->cpu_invoke) {
+        // A CPU thread runs this context; it switches queues itself once it is idle
+        __atomic_store_n(&(a->bind_seq), seq, __ATOMIC_RELEASE);
+        // Wake it up if it sleeps on the old queue
+        sm_queue_notify(old_q, SM_QUEUE_PUSHED);
+        return;
+    }
+
+    // The AVU holds the queue pointer of the context; replace the context in place, keeping
+    // the accelerator initialized and the hpthread on the same context
+    struct esp_access *esp_access_desc = accel->esp_access_desc;
+    bitset_reset(accel->valid_contexts, context);
+    {
+        esp_access_desc->context_id = context;
+        esp_access_desc->valid_contexts = accel->valid_contexts;
+        esp_access_desc->ioctl_cm = ESP_IOCTL_ACC_DEL_CONTEXT;
+    }
+    if (ioctl(accel->fd, accel->ioctl_cm, esp_access_desc)) {
+        perror("ioctl");
+        exit(EXIT_FAILURE);
+    }
+    bitset_set(accel->valid_contexts, context);
+    __atomic_store_n(&(a->bind_seq), seq, __ATOMIC_RELEASE);
+    vam_configure_accel(th, accel, context);
+}
+
 void vam_setprio_accel(hpthread_t *th) {
     physical_accel_t *accel = th->accel;
     unsigned context = th->accel_context;
     LOW_DEBUG(printf("[VAM] Setting priority of accel %s:%d to %d for hpthread %s\n", physical_accel_get_name(accel), context, th->nprio, hpthread_get_name(th));)
+    // No hardware to configure for CPU threads
+    if (accel->prim == PRIM_NONE) return;
 
     struct esp_access *esp_access_desc = accel->esp_access_desc;
     {
@@ -592,6 +718,30 @@ void vam_setprio_accel(hpthread_t *th) {
     }
 }
 
+void vam_publish_snapshot() {
+    hpthread_snap_t snap[VAM_SNAP_MAX];
+    unsigned n = 0;
+    physical_accel_t *cur_accel = accel_list;
+    while (cur_accel != NULL && n < VAM_SNAP_MAX) {
+        hpthread_snap_t *e = &snap[n++];
+        e->accel_id = cur_accel->accel_id;
+        e->prim = cur_accel->prim;
+        e->cpu_invoke = cur_accel->cpu_invoke;
+        e->free_contexts = MAX_CONTEXTS - bitset_count(cur_accel->valid_contexts);
+        e->effective_util = cur_accel->effective_util;
+        e->queue_pressure = 0.0;
+        for (int i = 0; i < MAX_CONTEXTS; i++) {
+            if (bitset_test(cur_accel->valid_contexts, i)) {
+                hpthread_args_t *a = cur_accel->th[i]->args;
+                sm_queue_t *q = (sm_queue_t *) ((unsigned *) (a->mem) + a->queue_ptr);
+                e->queue_pressure += (float) sm_queue_level(q) / sm_queue_capacity(q);
+            }
+        }
+        cur_accel = cur_accel->next;
+    }
+    hpthread_intf_publish(snap, n);
+}
+
 void insert_physical_accel(physical_accel_t *accel) {
     accel->next = NULL;
     if (!accel_list) {
@@ -613,6 +763,12 @@ void insert_cpu_thread(physical_accel_t *accel) {
 	cpu_thread_list = accel;
 }
 
+void remove_cpu_thread(physical_accel_t *accel) {
+	physical_accel_t **p = &cpu_thread_list;
+	while (*p && *p != accel) p = &((*p)->next);
+	if (*p) *p = accel->next;
+}
+
 void vam_check_utilization() {
     physical_accel_t *cur_accel = accel_list;
     while(cur_accel != NULL) {